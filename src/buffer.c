@@ -24,6 +24,9 @@
 #include <system-ioctl.h>
 
 #include <signal.h>
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 
 #include <closeout.h>
 #include <fnmatch.h>
@@ -42,7 +45,7 @@ static tarlong prev_written;    /* bytes written on previous volumes */
 static tarlong bytes_written;   /* bytes written on this volume */
 static void *record_buffer[2];  /* allocated memory */
 union block *record_buffer_aligned[2];
-static int record_index;
+static size_t record_index;
 
 /* FIXME: The following variables should ideally be static to this
    module.  However, this cannot be done yet.  The cleanup continues!  */
@@ -66,6 +69,8 @@ static void backspace_output (void);
 /* PID of child program, if compress_option or remote archive access.  */
 static pid_t child_pid;
 
+static bool frame_index_load (void);
+
 /* Error recovery stuff  */
 static int read_error_count;
 
@@ -269,7 +274,8 @@ enum compress_type {
   ct_lzip,
   ct_lzma,
   ct_lzop,
-  ct_xz
+  ct_xz,
+  ct_zstd
 };
 
 static enum compress_type archive_compression_type = ct_none;
@@ -298,6 +304,7 @@ static struct zip_magic const magic[] = {
   { ct_lzma,     6, "\xFFLZMA" },
   { ct_lzop,     4, "\211LZO" },
   { ct_xz,       6, "\xFD" "7zXZ" },
+  { ct_zstd,     4, "\x28\xB5\x2F\xFD" },
 };
 
 #define NMAGIC (sizeof(magic)/sizeof(magic[0]))
@@ -313,6 +320,7 @@ static struct zip_program zip_program[] = {
   { ct_lzma,     XZ_PROGRAM,       "-J" },
   { ct_lzop,     LZOP_PROGRAM,     "--lzop" },
   { ct_xz,       XZ_PROGRAM,       "-J" },
+  { ct_zstd,     ZSTD_PROGRAM,     "--zstd" },
   { ct_none }
 };
 
@@ -406,6 +414,8 @@ static void
 guess_seekable_archive (void)
 {
   struct stat st;
+  bool compressed = (use_compress_program_option
+		     || archive_compression_type != ct_none);
 
   if (subcommand_option == DELETE_SUBCOMMAND)
     {
@@ -420,16 +430,17 @@ guess_seekable_archive (void)
     }
 
   if (seek_option != -1)
-    {
-      seekable_archive = !!seek_option;
-      return;
-    }
-
-  if (!multi_volume_option && !use_compress_program_option
-      && fstat (archive, &st) == 0)
-    seekable_archive = S_ISREG (st.st_mode);
-  else
+    seekable_archive = !!seek_option;
+  else if (multi_volume_option)
     seekable_archive = false;
+  else if (compressed)
+    seekable_archive = true;
+  else
+    seekable_archive = fstat (archive, &st) == 0 && S_ISREG (st.st_mode);
+
+  /* A compressed archive can only be seeked in using its frame index.  */
+  if (seekable_archive && compressed)
+    seekable_archive = frame_index_load ();
 }
 
 /* Open an archive named archive_name_array[0]. Detect if it is
@@ -438,6 +449,8 @@ guess_seekable_archive (void)
 static int
 open_compressed_archive (void)
 {
+  int state;
+
   archive = rmtopen (archive_name_array[0], O_RDONLY | O_BINARY,
                      MODE_RW, rsh_command_option);
   if (archive == -1)
@@ -478,7 +491,15 @@ open_compressed_archive (void)
                           check_compressed_archive */
 
       /* Open compressed archive */
-      child_pid = sys_child_open_for_uncompress ();
+      if (zip_start (first_decompress_program (&state), false))
+        {
+          archive = rmtopen (archive_name_array[0], O_RDONLY | O_BINARY,
+                             MODE_RW, rsh_command_option);
+          if (archive == -1)
+            return archive;
+        }
+      else
+        child_pid = sys_child_open_for_uncompress (0);
       read_full_records = true;
     }
 
@@ -520,6 +541,17 @@ print_total_stats ()
       /* Amanda 2.4.1p1 looks for "Total bytes written: [0-9][0-9]*".  */
       print_stats (stderr, _("Total bytes written"),
                    prev_written + bytes_written);
+      if (link_table_memory ())
+        {
+          char buf[UINTMAX_STRSIZE_BOUND];
+          char abbr[LONGEST_HUMAN_READABLE + 1];
+          fprintf (stderr, _("Hard link table memory: %s (%s)\n"),
+                   STRINGIFY_BIGINT (link_table_memory (), buf),
+                   human_readable (link_table_memory (), abbr,
+                                   (human_autoscale | human_base_1024
+                                    | human_SI | human_B),
+                                   1, 1));
+        }
       break;
 
     case DELETE_SUBCOMMAND:
@@ -663,13 +695,33 @@ _open_archive (enum access_mode wanted_access)
       switch (wanted_access)
         {
         case ACCESS_READ:
-          child_pid = sys_child_open_for_uncompress ();
+          if (!zip_start (use_compress_program_option, false))
+            child_pid = sys_child_open_for_uncompress (0);
+          else if (strcmp (archive_name_array[0], "-") == 0)
+            archive = STDIN_FILENO;
+          else
+            archive = rmtopen (archive_name_array[0], O_RDONLY | O_BINARY,
+                               MODE_RW, rsh_command_option);
           read_full_records = true;
           record_end = record_start; /* set up for 1st record = # 0 */
+          guess_seekable_archive ();
           break;
 
         case ACCESS_WRITE:
-          child_pid = sys_child_open_for_compress ();
+          if (!zip_start (use_compress_program_option, true))
+            child_pid = sys_child_open_for_compress (false);
+          else if (strcmp (archive_name_array[0], "-") == 0)
+            archive = STDOUT_FILENO;
+          else
+            {
+              if (backup_option)
+                {
+                  maybe_backup_file (archive_name_array[0], 1);
+                  backed_up_flag = 1;
+                }
+              archive = rmtcreat (archive_name_array[0], MODE_RW,
+                                  rsh_command_option);
+            }
           break;
 
         case ACCESS_UPDATE:
@@ -776,6 +828,8 @@ _open_archive (enum access_mode wanted_access)
   sys_detect_dev_null_output ();
   sys_save_archive_dev_ino ();
   SET_BINARY_MODE (archive);
+  if (wanted_access == ACCESS_WRITE)
+    sys_direct_archive ();
 
   switch (wanted_access)
     {
@@ -790,6 +844,1028 @@ _open_archive (enum access_mode wanted_access)
     }
 }
 
+/* Seekable compressed archives.
+
+   With --seekable-compression, a gzip or zstd compressed archive is
+   written as a sequence of frames, each of them a complete gzip member
+   or zstd frame holding a fixed number of records.  When tar compresses
+   the archive itself, it just ends the stream and begins a new one at
+   every frame boundary; otherwise it has to wait for the compressor to
+   exit and start another one appending to the archive, which is why
+   frames are large by default.  Decompressors still see a single
+   stream.  The frames are followed by their index:
+   an empty gzip member carrying it in its comment field, or a zstd
+   skippable frame.  The index is a text of the form
+
+     GNU tar frame index
+     TAR-OFFSET ARCHIVE-OFFSET
+     ...
+     INDEX-OFFSET
+
+   with a line for each frame, giving the offset of its first record in
+   the tar stream and its own offset in the archive file.  The last line
+   is the offset of the index itself, which makes it easy to find from
+   the end of the file.
+
+   When such an archive is read from a regular file, seek_archive skips
+   whole frames by restarting the decompressor at the last frame that
+   begins before the target position.  */
+
+struct frame
+{
+  off_t tar_offset;             /* Offset of the frame in the tar stream */
+  off_t zip_offset;             /* Offset of the frame in the archive */
+};
+
+static struct frame *frame_index;
+static size_t frame_count;
+static size_t frame_alloc;
+
+/* Number of records per frame and number of records already written
+   to the current one, when creating a framed archive.  */
+static size_t frame_records;
+static size_t frame_fill;
+
+/* Compression of the framed archive being created.  */
+static enum compress_type frame_type;
+
+static char const frame_index_title[] = "GNU tar frame index\n";
+
+/* Header of a gzip member with a comment, and trailer of an empty one.  */
+static char const gzip_index_head[10] = "\037\213\010\020\0\0\0\0\0\377";
+static char const gzip_index_tail[10] = "\003\0\0\0\0\0\0\0\0\0";
+
+/* Magic number of the zstd skippable frame holding the index.  */
+static char const zstd_index_magic[4] = "\x5E\x2A\x4D\x18";
+
+static void
+frame_add (off_t tar_offset, off_t zip_offset)
+{
+  if (frame_count == frame_alloc)
+    frame_index = x2nrealloc (frame_index, &frame_alloc,
+			      sizeof *frame_index);
+  frame_index[frame_count].tar_offset = tar_offset;
+  frame_index[frame_count].zip_offset = zip_offset;
+  frame_count++;
+}
+
+/* Decide whether the archive being created is to be framed.  */
+static void
+frame_write_start (void)
+{
+  struct stat st;
+
+  frame_records = 0;
+  frame_count = 0;
+  if (!seekable_compression_option)
+    return;
+
+  if (!use_compress_program_option)
+    frame_type = ct_none;
+  else if (strcmp (use_compress_program_option, GZIP_PROGRAM) == 0)
+    frame_type = ct_gzip;
+  else if (strcmp (use_compress_program_option, ZSTD_PROGRAM) == 0)
+    frame_type = ct_zstd;
+  else
+    frame_type = ct_none;
+
+  if (frame_type == ct_none
+      || subcommand_option != CREATE_SUBCOMMAND
+      || multi_volume_option || verify_option
+      || strcmp (archive_name_array[0], "-") == 0
+      || _remdev (archive_name_array[0])
+      || (stat (archive_name_array[0], &st) == 0
+	  ? !S_ISREG (st.st_mode) : errno != ENOENT))
+    {
+      WARN ((0, 0, _("--seekable-compression ignored: it needs a gzip or"
+		     " zstd compressed archive created in a regular file")));
+      return;
+    }
+
+  frame_records = (seekable_compression_option + record_size - 1)
+                  / record_size;
+  frame_fill = 0;
+  frame_add (0, 0);
+}
+
+/* Finish the current frame and start compressing the next one.  */
+static void
+frame_next (void)
+{
+  off_t zip_offset;
+
+  if (zip_active ())
+    zip_offset = zip_next_stream ();
+  else
+    {
+      struct stat st;
+
+      if (rmtclose (archive) != 0)
+	close_error (*archive_name_cursor);
+      sys_wait_for_child (child_pid, false);
+      if (stat (archive_name_array[0], &st) != 0)
+	stat_fatal (archive_name_array[0]);
+      zip_offset = st.st_size;
+      child_pid = sys_child_open_for_compress (true);
+    }
+  frame_add (frame_index[frame_count - 1].tar_offset
+	     + (off_t) frame_records * record_size,
+	     zip_offset);
+  frame_fill = 0;
+}
+
+/* Append the frame index to the archive just created.  */
+static void
+frame_write_index (void)
+{
+  char buf1[UINTMAX_STRSIZE_BOUND];
+  char buf2[UINTMAX_STRSIZE_BOUND];
+  struct stat st;
+  char *data;
+  char *text;
+  char *p;
+  size_t length;
+  size_t i;
+  int fd;
+
+  fd = open (archive_name_array[0], O_WRONLY | O_APPEND | O_BINARY);
+  if (fd < 0)
+    open_fatal (archive_name_array[0]);
+  if (fstat (fd, &st) != 0)
+    stat_fatal (archive_name_array[0]);
+
+  data = xmalloc (sizeof gzip_index_head + sizeof frame_index_title
+		   + (frame_count + 1) * 2 * UINTMAX_STRSIZE_BOUND
+		   + 1 + sizeof gzip_index_tail);
+  text = p = data + sizeof gzip_index_head;
+  p = strcpy (p, frame_index_title) + strlen (frame_index_title);
+  for (i = 0; i < frame_count; i++)
+    p += sprintf (p, "%s %s\n",
+		  STRINGIFY_BIGINT (frame_index[i].tar_offset, buf1),
+		  STRINGIFY_BIGINT (frame_index[i].zip_offset, buf2));
+  p += sprintf (p, "%s\n", STRINGIFY_BIGINT (st.st_size, buf1));
+  length = p - text;
+
+  if (frame_type == ct_gzip)
+    {
+      memcpy (data, gzip_index_head, sizeof gzip_index_head);
+      *p++ = 0;
+      memcpy (p, gzip_index_tail, sizeof gzip_index_tail);
+      p += sizeof gzip_index_tail;
+      text = data;
+    }
+  else
+    {
+      text -= 8;
+      memcpy (text, zstd_index_magic, sizeof zstd_index_magic);
+      for (i = 0; i < 4; i++)
+	text[4 + i] = (length >> (8 * i)) & 0xff;
+    }
+
+  length = p - text;
+  if (full_write (fd, text, length) != length)
+    write_fatal_details (archive_name_array[0], -1, length);
+  if (close (fd) != 0)
+    close_error (archive_name_array[0]);
+  free (data);
+}
+
+/* Load the frame index of the compressed archive being read, if it has
+   one.  Return true if it does.  */
+static bool
+frame_index_load (void)
+{
+  char tail[sizeof gzip_index_tail + UINTMAX_STRSIZE_BOUND + 2];
+  char const *name = archive_name_array[0];
+  struct stat st;
+  size_t length;
+  size_t size;
+  char *data = NULL;
+  char *text;
+  char *end;
+  char *p;
+  uintmax_t index_offset;
+  bool gzip;
+  int fd;
+
+  frame_count = 0;
+  frame_records = 0;
+  if (strcmp (name, "-") == 0 || _remdev (name))
+    return false;
+  fd = open (name, O_RDONLY | O_BINARY);
+  if (fd < 0)
+    return false;
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode))
+    goto fail;
+
+  /* Find the offset of the index from its last line.  */
+  length = st.st_size < sizeof tail ? st.st_size : sizeof tail;
+  if (lseek (fd, st.st_size - length, SEEK_SET) < 0
+      || safe_read (fd, tail, length) != length)
+    goto fail;
+  end = tail + length;
+  gzip = (length > sizeof gzip_index_tail
+	  && memcmp (end - sizeof gzip_index_tail, gzip_index_tail,
+		     sizeof gzip_index_tail) == 0
+	  && *(end - sizeof gzip_index_tail - 1) == 0);
+  if (gzip)
+    end -= sizeof gzip_index_tail + 1;
+  if (end == tail || end[-1] != '\n')
+    goto fail;
+  for (p = end - 1; p > tail && ISDIGIT (p[-1]); p--)
+    continue;
+  if (p == end - 1 || p == tail || p[-1] != '\n'
+      || xstrtoumax (p, &text, 10, &index_offset, NULL) != LONGINT_OK
+      || text != end - 1 || st.st_size <= index_offset)
+    goto fail;
+
+  /* Read the index and check its framing.  */
+  if (SIZE_MAX - 1 < st.st_size - index_offset)
+    goto fail;
+  size = st.st_size - index_offset;
+  data = xmalloc (size + 1);
+  if (lseek (fd, index_offset, SEEK_SET) < 0
+      || safe_read (fd, data, size) != size)
+    goto fail;
+  if (gzip)
+    {
+      if (size < sizeof gzip_index_head + 1 + sizeof gzip_index_tail
+	  || memcmp (data, gzip_index_head, sizeof gzip_index_head) != 0)
+	goto fail;
+      text = data + sizeof gzip_index_head;
+      end = data + size - sizeof gzip_index_tail - 1;
+    }
+  else
+    {
+      size_t i;
+
+      if (size < 8 || memcmp (data, zstd_index_magic,
+			       sizeof zstd_index_magic) != 0)
+	goto fail;
+      length = 0;
+      for (i = 0; i < 4; i++)
+	length |= (size_t) (unsigned char) data[4 + i] << (8 * i);
+      if (length != size - 8)
+	goto fail;
+      text = data + 8;
+      end = data + size;
+    }
+  *end = 0;
+
+  /* Parse the index.  */
+  if (strncmp (text, frame_index_title, strlen (frame_index_title)) != 0)
+    goto fail;
+  p = text + strlen (frame_index_title);
+  for (;;)
+    {
+      uintmax_t tar_offset, zip_offset;
+
+      if (xstrtoumax (p, &p, 10, &tar_offset, NULL) != LONGINT_OK)
+	goto fail;
+      if (*p == '\n')
+	{
+	  /* The last line.  */
+	  if (tar_offset != index_offset || p != end - 1 || frame_count == 0)
+	    goto fail;
+	  break;
+	}
+      if (*p != ' '
+	  || xstrtoumax (p + 1, &p, 10, &zip_offset, NULL) != LONGINT_OK
+	  || *p++ != '\n'
+	  || TYPE_MAXIMUM (off_t) < tar_offset
+	  || index_offset < zip_offset
+	  || (frame_count == 0
+	      ? tar_offset != 0 || zip_offset != 0
+	      : (tar_offset < frame_index[frame_count - 1].tar_offset
+		 || zip_offset < frame_index[frame_count - 1].zip_offset)))
+	goto fail;
+      frame_add (tar_offset, zip_offset);
+    }
+
+  free (data);
+  close (fd);
+  return true;
+
+ fail:
+  frame_count = 0;
+  free (data);
+  close (fd);
+  return false;
+}
+
+/* Shared record rings.
+
+   With --write-behind or --read-ahead, the pair of record buffers is
+   replaced by a ring of records kept in memory shared with a helper
+   process, which does the actual archive I/O.  Tar and the helper pass
+   slot numbers to each other over a pair of pipes: tar sends the number
+   of each slot the helper may process, and the helper sends back a
+   ring_reply for it, in the same order, once the slot is written out or
+   filled in.  While a ring is in use, record_index is the number of the
+   slot tar is working on.  */
+
+#if HAVE_SYS_MMAN_H && defined MAP_SHARED && defined MAP_ANONYMOUS
+# define HAVE_SHARED_RING 1
+#else
+# define HAVE_SHARED_RING 0
+#endif
+
+struct ring_reply
+{
+  size_t slot;                  /* Slot that has been processed */
+  ssize_t status;               /* Number of bytes transferred, or value
+				   returned by the failed call */
+  int errnum;                   /* Value of errno after the call */
+};
+
+static char *ring_base;         /* Shared ring of records */
+static size_t ring_slots;       /* Number of records in the ring */
+static size_t ring_unused;      /* Number of slots not handed out yet */
+static size_t ring_pending;     /* Slots passed to the helper and not
+				   yet reported back */
+static int ring_cmd_fd;         /* Slot numbers, from tar to the helper */
+static int ring_reply_fd;       /* Replies, from the helper to tar */
+static pid_t ring_pid;          /* PID of the helper process, or 0 */
+
+/* Allocate a shared ring of SLOTS records.  On failure, warn and return
+   false, so that the caller falls back to synchronous I/O.  */
+static bool
+ring_alloc (size_t slots)
+{
+#if HAVE_SHARED_RING
+  size_t size = slots * record_size;
+  void *ptr;
+
+  if (size / record_size != slots)
+    xalloc_die ();
+  ptr = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+	      -1, 0);
+  if (ptr != MAP_FAILED)
+    {
+# ifdef MADV_HUGEPAGE
+      madvise (ptr, size, MADV_HUGEPAGE);
+# endif
+      ring_base = ptr;
+      ring_slots = slots;
+      return true;
+    }
+  WARN ((0, errno, _("Cannot allocate shared record buffers")));
+#endif
+  return false;
+}
+
+/* Release the ring and return to the ordinary record buffer.  */
+static void
+ring_free (void)
+{
+#if HAVE_SHARED_RING
+  if (!ring_base)
+    return;
+  munmap (ring_base, ring_slots * record_size);
+  ring_base = NULL;
+  record_index = 0;
+  init_buffer ();
+#endif
+}
+
+/* Read exactly SIZE bytes from the pipe FD into BUF.  Return false on
+   end of file.  */
+static bool
+ring_read (int fd, void *buf, size_t size)
+{
+  char *p = buf;
+
+  while (size)
+    {
+      size_t n = safe_read (fd, p, size);
+      if (n == SAFE_READ_ERROR)
+	read_fatal (_("(pipe)"));
+      if (n == 0)
+	return false;
+      p += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* Make slot number SLOT of the ring the current record.  */
+static void
+ring_select (size_t slot)
+{
+  record_index = slot;
+  record_start = (union block *) (ring_base + slot * record_size);
+  current_block = record_start;
+  record_end = record_start + blocking_factor;
+}
+
+/* Pass slot number SLOT to the helper.  */
+static void
+ring_send (size_t slot)
+{
+  if (full_write (ring_cmd_fd, &slot, sizeof slot) != sizeof slot)
+    FATAL_ERROR ((0, errno, _("Cannot pass record to helper process")));
+  ring_pending++;
+}
+
+/* Get the next reply from the helper into REPLY.  */
+static void
+ring_receive (struct ring_reply *reply)
+{
+  if (!ring_read (ring_reply_fd, reply, sizeof *reply))
+    FATAL_ERROR ((0, 0, _("Helper process exited unexpectedly")));
+  ring_pending--;
+}
+
+/* Start a helper process running LOOP, which is given the descriptors
+   to read slot numbers from and to send replies to.  The descriptors
+   kept by tar are closed on exec, so that they are not held open by
+   the commands tar runs.  */
+static void
+ring_spawn (void (*loop) (int, int))
+{
+  int cmd_pipe[2];
+  int reply_pipe[2];
+
+  xpipe (cmd_pipe);
+  xpipe (reply_pipe);
+  ring_pid = xfork ();
+  if (ring_pid == 0)
+    {
+      xclose (cmd_pipe[1]);
+      xclose (reply_pipe[0]);
+      loop (cmd_pipe[0], reply_pipe[1]);
+    }
+  xclose (cmd_pipe[0]);
+  xclose (reply_pipe[1]);
+  ring_cmd_fd = cmd_pipe[1];
+  ring_reply_fd = reply_pipe[0];
+  fcntl (ring_cmd_fd, F_SETFD, FD_CLOEXEC);
+  fcntl (ring_reply_fd, F_SETFD, FD_CLOEXEC);
+  ring_pending = 0;
+}
+
+/* Tell the helper there is no more work and wait for it to exit.
+   Replies still pending are passed to REAP if it is not NULL.
+   Otherwise, whatever the helper sends until it exits is discarded.  */
+static void
+ring_stop (void (*reap) (struct ring_reply const *))
+{
+  struct ring_reply reply;
+
+  xclose (ring_cmd_fd);
+  if (reap)
+    while (ring_pending)
+      {
+	ring_receive (&reply);
+	reap (&reply);
+      }
+  else
+    while (ring_read (ring_reply_fd, &reply, sizeof reply))
+      continue;
+  xclose (ring_reply_fd);
+  sys_wait_for_child (ring_pid, false);
+  ring_pid = 0;
+}
+
+/* In a helper process forked by tar, close the descriptors of the
+   archive, of the write-behind or read-ahead helper and of the
+   compression workers, so that they are not kept open once tar has
+   closed them.  */
+void
+close_archive_descriptors (void)
+{
+  if (0 <= archive && !_isrmt (archive))
+    close (archive);
+  if (ring_pid)
+    {
+      close (ring_cmd_fd);
+      close (ring_reply_fd);
+    }
+  zip_close_descriptors ();
+}
+
+/* Exit from a helper process.  Do not run the exit hooks: the output
+   streams belong to the parent tar.  */
+static void ring_exit (void) __attribute__ ((noreturn));
+
+static void
+ring_exit (void)
+{
+  _exit (0);
+}
+
+/* Write-behind.  Each time a record is filled, its slot is passed to the
+   writer, which writes it to the archive while tar goes on filling the
+   next free slot.  Write errors are thus diagnosed exactly as in
+   synchronous mode, only a few records later.  When tar compresses the
+   archive itself, the writer runs the compressor too, and ends the
+   compressed stream once it has written the last record.  */
+
+/* Main loop of the writer process.  */
+static void write_behind_loop (int cmd_fd, int reply_fd)
+  __attribute__ ((noreturn));
+
+static void
+write_behind_loop (int cmd_fd, int reply_fd)
+{
+  size_t slot;
+
+  set_program_name (_("tar (writer)"));
+
+  while (ring_read (cmd_fd, &slot, sizeof slot))
+    {
+      struct ring_reply reply;
+
+      ring_select (slot);
+      reply.slot = slot;
+      errno = 0;
+      reply.status = sys_write_archive_buffer ();
+      reply.errnum = errno;
+      if (full_write (reply_fd, &reply, sizeof reply) != sizeof reply)
+	break;
+    }
+  zip_finish ();
+  ring_exit ();
+}
+
+/* Account for a record reported back by the writer.  */
+static void
+write_behind_reap (struct ring_reply const *reply)
+{
+  if (reply->status != record_size)
+    {
+      errno = reply->errnum;
+      archive_write_error (reply->status);
+    }
+  records_written++;
+  bytes_written += reply->status;
+}
+
+/* Flush function used while the write-behind ring is active: pass the
+   current record to the writer, and make a free slot current.  */
+static void
+write_behind_flush (size_t level __attribute__ ((unused)))
+{
+  size_t slot;
+
+  checkpoint_run (true);
+  ring_send (record_index);
+
+  if (ring_unused)
+    slot = ring_slots - ring_unused--;
+  else
+    {
+      struct ring_reply reply;
+      ring_receive (&reply);
+      write_behind_reap (&reply);
+      slot = reply.slot;
+    }
+  ring_select (slot);
+}
+
+/* Start the writer process, if --write-behind was given and the archive
+   allows it.  Records are then written in the order they are filled,
+   so the cases that rely on the outcome of each write being known
+   immediately (multi-volume archives, tape length limits, verification,
+   frames of seekable compressed archives) as well as remote archives
+   keep the synchronous method.  */
+static void
+write_behind_start (void)
+{
+  if (write_behind_option < 2 || dev_null_output)
+    return;
+  if (subcommand_option != CREATE_SUBCOMMAND
+      || multi_volume_option || verify_option || tape_length_option
+      || _isrmt (archive) || frame_records)
+    {
+      WARN ((0, 0, _("--write-behind ignored: it does not work with"
+		     " multi-volume, verified, length-limited, remote or"
+		     " seekable compressed archives")));
+      return;
+    }
+  if (!ring_alloc (write_behind_option))
+    return;
+
+  ring_spawn (write_behind_loop);
+  zip_disown ();
+  ring_unused = ring_slots - 1;
+  ring_select (0);
+  flush_write_ptr = write_behind_flush;
+}
+
+/* Wait until all queued records are written and stop the writer.  */
+static void
+write_behind_finish (void)
+{
+  if (!ring_pid)
+    return;
+  ring_stop (write_behind_reap);
+  ring_free ();
+}
+
+/* Memory-mapped archives.
+
+   A seekable archive, i.e. a regular file read directly, is mapped into
+   memory a window at a time, and its records are used right from the
+   mapping instead of being copied into the record buffer.  Skipping
+   members then only moves the current position, and only the pages
+   actually looked at are read in.  The mapping is private, in case
+   some code modifies the records it reads.
+
+   Only the part of the archive present when it was opened is mapped.
+   Past it, including for a final partial record, the archive is read
+   as usual from the corresponding position.
+
+   The previous window is kept mapped until the next one is replaced,
+   so that pointers to recently read blocks, such as current_header,
+   remain valid as long as they would with the record buffer.  */
+
+#if HAVE_SYS_MMAN_H && defined MAP_PRIVATE
+# define HAVE_ARCHIVE_MAP 1
+#else
+# define HAVE_ARCHIVE_MAP 0
+#endif
+
+/* Preferred size of the mapped window.  */
+enum { MAP_WINDOW = 64 * 1024 * 1024 };
+
+static bool map_enabled;        /* Are records taken from the mapping? */
+static off_t map_pos;           /* Archive offset of the next record */
+static off_t map_limit;         /* Size of the archive when opened */
+static char *map_base;          /* Mapped window, or NULL */
+static off_t map_offset;        /* Archive offset of map_base */
+static size_t map_length;       /* Size of the window */
+static char *map_prev_base;     /* Previous window, or NULL */
+static size_t map_prev_length;  /* Size of the previous window */
+static off_t map_advised;       /* Offset up to which the system was
+				   asked to read the archive ahead */
+
+/* Streams reading or writing the archive with --io-uring, if any.  */
+static struct uring_stream *archive_reader;
+static struct uring_stream *archive_writer;
+
+/* Unmap the previous window, if any, and retire the current one.  */
+static void
+archive_unmap_window (void)
+{
+#if HAVE_ARCHIVE_MAP
+  if (map_prev_base)
+    munmap (map_prev_base, map_prev_length);
+  map_prev_base = map_base;
+  map_prev_length = map_length;
+  map_base = NULL;
+#endif
+}
+
+/* Start taking records from a mapping of the archive, if it is a
+   seekable file.  The first record has already been read normally.  */
+static void
+archive_map_init (void)
+{
+#if HAVE_ARCHIVE_MAP
+  struct stat st;
+
+  if (!seekable_archive || archive_reader
+      || _isrmt (archive) || zip_active ()
+      || record_end - record_start != blocking_factor
+      || fstat (archive, &st) != 0 || !S_ISREG (st.st_mode))
+    return;
+
+  map_pos = lseek (archive, 0, SEEK_CUR);
+  if (map_pos < 0)
+    return;
+  map_limit = st.st_size;
+  map_advised = map_pos;
+  map_enabled = true;
+#endif
+}
+
+/* Stop using the mapping, and position the archive at the next record,
+   so that reading can go on in the usual way.  Return false on
+   failure.  */
+static bool
+archive_map_stop (void)
+{
+  archive_unmap_window ();
+  map_enabled = false;
+  record_start = record_buffer_aligned[record_index];
+  current_block = record_start;
+  record_end = record_start + blocking_factor;
+  return rmtlseek (archive, map_pos, SEEK_SET) == map_pos;
+}
+
+/* Make the record at map_pos current, remapping the window if needed.
+   Return false if it cannot be done.  */
+static bool
+archive_map_record (void)
+{
+#if HAVE_ARCHIVE_MAP
+  if (!(map_base
+	&& map_offset <= map_pos
+	&& map_pos + record_size <= map_offset + map_length))
+    {
+      size_t page = getpagesize ();
+      off_t offset = map_pos - map_pos % page;
+      size_t length = MAP_WINDOW;
+      void *ptr;
+
+      if (length < map_pos - offset + record_size)
+	length = map_pos - offset + record_size;
+      if (map_limit - offset < length)
+	length = map_limit - offset;
+
+      archive_unmap_window ();
+      ptr = mmap (NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		  archive, offset);
+      if (ptr == MAP_FAILED)
+	return false;
+      map_base = ptr;
+      map_offset = offset;
+      map_length = length;
+    }
+
+  /* With --read-ahead, keep the next records of the archive scheduled
+     for reading, so that they are in memory when faulted in.  */
+# ifdef POSIX_FADV_WILLNEED
+  if (2 <= read_ahead_option)
+    {
+      off_t ahead = (off_t) read_ahead_option * record_size;
+      if (map_advised - map_pos < ahead / 2)
+	{
+	  off_t start = map_advised < map_pos ? map_pos : map_advised;
+	  posix_fadvise (archive, start, map_pos + ahead - start,
+			 POSIX_FADV_WILLNEED);
+	  map_advised = map_pos + ahead;
+	}
+    }
+# endif
+
+  record_start = (union block *) (map_base + (map_pos - map_offset));
+  current_block = record_start;
+  record_end = record_start + blocking_factor;
+  map_pos += record_size;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Read up to SIZE bytes of the archive into BUF, as rmtread would do,
+   decompressing them if needed.  */
+static size_t
+archive_read (char *buf, size_t size)
+{
+  return zip_active () ? zip_read (buf, size) : rmtread (archive, buf, size);
+}
+
+/* Read-ahead.  The reader fills every slot tar hands to it with the
+   next record of the archive, so that reading the archive overlaps with
+   what tar does with the records already read.  Tar hands back each
+   slot as soon as it moves to the next record.  When tar decompresses
+   the archive itself, the reader runs the decompressor, and tar finds
+   the end of the data once the reader has stopped.
+
+   The reader stops at the first record it cannot read in full, leaving
+   the archive positioned right after the data it did read.  Since the
+   reader shares the archive file description with tar, the ordinary
+   code in flush_read then takes over at that point, with the partial
+   record in the current slot, and handles short records, read errors
+   and volume switching as usual.  */
+
+/* True if the archive may be read ahead, i.e. the reader is running or
+   is to be started on the next read.  */
+static bool read_ahead_enabled;
+
+/* Main loop of the reader process.  */
+static void read_ahead_loop (int cmd_fd, int reply_fd)
+  __attribute__ ((noreturn));
+
+static void
+read_ahead_loop (int cmd_fd, int reply_fd)
+{
+  size_t slot;
+
+  set_program_name (_("tar (reader)"));
+
+  while (ring_read (cmd_fd, &slot, sizeof slot))
+    {
+      struct ring_reply reply;
+      char *buf = ring_base + slot * record_size;
+      size_t got = 0;
+      size_t status;
+
+      /* Reblock input from pipes, but keep the record boundaries of
+	 other archives, for short_read to examine.  */
+      do
+	{
+	  status = archive_read (buf + got, record_size - got);
+	  if (status == 0 || status == SAFE_READ_ERROR)
+	    break;
+	  got += status;
+	}
+      while (got < record_size && read_full_records);
+
+      reply.slot = slot;
+      reply.status = got ? got : status;
+      reply.errnum = errno;
+      if (full_write (reply_fd, &reply, sizeof reply) != sizeof reply)
+	ring_exit ();
+      if (got != record_size)
+	break;
+    }
+
+  /* Ignore the slots still handed to us, so that tar does not get
+     SIGPIPE, until told to exit.  */
+  while (ring_read (cmd_fd, &slot, sizeof slot))
+    continue;
+  ring_exit ();
+}
+
+/* Start reading the archive ahead: hand all slots but the current one
+   to the reader.  */
+static void
+read_ahead_start (void)
+{
+  size_t i;
+
+  ring_spawn (read_ahead_loop);
+  zip_disown ();
+  for (i = 1; i < ring_slots; i++)
+    ring_send ((record_index + i) % ring_slots);
+}
+
+/* Stop the reader, dropping the records it has read ahead.  The
+   archive is then positioned after the last of them.  */
+static void
+read_ahead_stop (void)
+{
+  if (ring_pid)
+    ring_stop (NULL);
+}
+
+/* Decide whether the archive just opened can be read ahead.  Only
+   sequential readers of local files, pipes and the like qualify: the
+   reader may consume up to a ring worth of data past the end of the
+   archive, which must not happen on tapes, and the commands that
+   modify the archive need to know its exact position.  A mapped
+   archive is read ahead by the system instead, as archive_map_record
+   asks it to.  */
+static void
+read_ahead_init (void)
+{
+  struct stat st;
+
+  if (read_ahead_option < 2 || map_enabled || archive_reader)
+    return;
+  if (!(subcommand_option == LIST_SUBCOMMAND
+	|| subcommand_option == EXTRACT_SUBCOMMAND
+	|| subcommand_option == DIFF_SUBCOMMAND)
+      || _isrmt (archive)
+      || fstat (archive, &st) != 0
+      || S_ISCHR (st.st_mode) || S_ISBLK (st.st_mode))
+    {
+      WARN ((0, 0, _("--read-ahead ignored: it only works when listing,"
+		     " extracting or comparing a local archive that is"
+		     " not a device")));
+      return;
+    }
+
+  if (!ring_base)
+    {
+      union block *old = record_start;
+      size_t blocks = record_end - record_start;
+
+      if (!ring_alloc (read_ahead_option))
+	return;
+      /* Move the record read by _open_archive to the ring.  */
+      memcpy (ring_base, old, record_size);
+      ring_select (0);
+      record_end = record_start + blocks;
+    }
+  read_ahead_enabled = true;
+}
+
+/* Queued archive I/O.  With --io-uring, an archive that is a local
+   regular file is written, or read when listing, extracting or
+   comparing, through a stream of uring.c, which keeps several records
+   in progress while tar goes on with the current one.  Other archives,
+   and those written or read by a helper process or through the
+   compression library, keep the usual method.  The archive descriptor
+   is positioned where it would be without the stream whenever the
+   stream is stopped, so that the usual method can take over.  */
+
+/* Start reading the archive, from its current position, through a
+   stream, if the archive allows it.  */
+static void
+archive_reader_start (void)
+{
+  off_t offset = lseek (archive, 0, SEEK_CUR);
+
+  if (0 <= offset)
+    archive_reader = uring_open_read (archive, offset, -1, URING_CHUNK);
+}
+
+/* Stop the stream, if any, and position the archive after the data
+   read or written through it.  Return false if it had a write
+   error, with errno set.  */
+static bool
+archive_uring_stop (void)
+{
+  struct uring_stream *s = archive_reader ? archive_reader : archive_writer;
+  off_t pos;
+  bool ok;
+
+  if (!s)
+    return true;
+  pos = uring_tell (s);
+  ok = uring_close (s);
+  archive_reader = archive_writer = NULL;
+  if (ok)
+    lseek (archive, pos, SEEK_SET);
+  return ok;
+}
+
+/* Decide whether the archive just opened can be read or written
+   through a stream.  */
+static void
+archive_uring_init (void)
+{
+  struct stat st;
+  int flags;
+
+  if (!io_uring_option || ring_pid || read_ahead_enabled || zip_active ()
+      || multi_volume_option || _isrmt (archive)
+      || fstat (archive, &st) != 0 || !S_ISREG (st.st_mode)
+      || (flags = fcntl (archive, F_GETFL)) < 0 || (flags & O_APPEND))
+    return;
+
+  if (access_mode == ACCESS_WRITE)
+    {
+      off_t offset;
+
+      if (subcommand_option != CREATE_SUBCOMMAND
+	  || verify_option || tape_length_option || frame_records
+	  || direct_io_option)
+	return;
+      offset = lseek (archive, 0, SEEK_CUR);
+      if (0 <= offset)
+	archive_writer = uring_open_write (archive, offset, URING_CHUNK);
+    }
+  else if (subcommand_option == LIST_SUBCOMMAND
+	   || subcommand_option == EXTRACT_SUBCOMMAND
+	   || subcommand_option == DIFF_SUBCOMMAND)
+    archive_reader_start ();
+}
+
+/* Read the next record of the archive into the current record buffer,
+   as archive_read would do.  */
+static size_t
+archive_read_record (void)
+{
+  struct ring_reply reply;
+
+  if (archive_reader)
+    {
+      off_t pos = uring_tell (archive_reader);
+      size_t status = uring_read (archive_reader, record_start->buffer,
+				  record_size);
+      if (status == record_size)
+	return status;
+
+      /* Let the usual method read this record again, and deal with a
+	 short record or an error as it does.  */
+      archive_uring_stop ();
+      if (lseek (archive, pos, SEEK_SET) != pos)
+	return SAFE_READ_ERROR;
+    }
+
+  if (map_enabled)
+    {
+      if (map_pos + record_size <= map_limit && archive_map_record ())
+	return record_size;
+      if (!archive_map_stop ())
+	return SAFE_READ_ERROR;
+    }
+
+  if (!read_ahead_enabled)
+    return archive_read (record_start->buffer, record_size);
+
+  if (!ring_pid)
+    read_ahead_start ();
+  ring_send (record_index);
+  ring_receive (&reply);
+  ring_select (reply.slot);
+  if (reply.status != record_size)
+    {
+      /* The reader has stopped.  Let it exit, and go on synchronously
+	 from where it left off.  */
+      read_ahead_stop ();
+      read_ahead_enabled = false;
+      errno = reply.errnum;
+    }
+  return reply.status;
+}
+
 /* Perform a write to flush the buffer.  */
 static ssize_t
 _flush_write (void)
@@ -804,9 +1880,16 @@ _flush_write (void)
     }
   else if (dev_null_output)
     status = record_size;
+  else if (archive_writer)
+    status = (uring_write (archive_writer, record_start->buffer, record_size)
+	      ? record_size : 0);
   else
     status = sys_write_archive_buffer ();
 
+  if (frame_records && status == record_size
+      && ++frame_fill == frame_records)
+    frame_next ();
+
   if (status && multi_volume_option && !inhibit_map)
     {
       struct bufmap *map = bufmap_locate (status);
@@ -899,7 +1982,7 @@ short_read (size_t status)
          || (left && status && read_full_records))
     {
       if (status)
-        while ((status = rmtread (archive, more, left)) == SAFE_READ_ERROR)
+        while ((status = archive_read (more, left)) == SAFE_READ_ERROR)
           archive_read_error ();
 
       if (status == 0)
@@ -998,6 +2081,52 @@ backspace_output (void)
   }
 }
 
+/* Restart the decompressor at the last frame of the archive that starts
+   at a record boundary at or before the tar stream offset TARGET, if
+   that is past POS, the offset of the next record to read.  Return the
+   tar stream offset the archive is then positioned at, or -1 if
+   nothing was done.  */
+static off_t
+frame_seek (off_t pos, off_t target)
+{
+  size_t lo = 0, hi = frame_count;
+  struct frame const *f;
+
+  /* Find the first frame past TARGET.  */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (frame_index[mid].tar_offset <= target)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  for (f = frame_index + lo; f > frame_index; f--)
+    if (f[-1].tar_offset % record_size == 0)
+      break;
+  if (f == frame_index || f[-1].tar_offset <= pos)
+    return -1;
+  f--;
+
+  read_ahead_stop ();
+  if (zip_active ())
+    {
+      if (!zip_seek (f->zip_offset))
+	{
+	  seek_error_details (*archive_name_cursor, f->zip_offset);
+	  fatal_exit ();
+	}
+    }
+  else
+    {
+      rmtclose (archive);
+      sys_stop_child (child_pid);
+      child_pid = sys_child_open_for_uncompress (f->zip_offset);
+    }
+  return f->tar_offset;
+}
+
 off_t
 seek_archive (off_t size)
 {
@@ -1014,7 +2143,45 @@ seek_archive (off_t size)
   nrec = (size - skipped) / record_size;
   if (nrec == 0)
     return 0;
-  offset = rmtlseek (archive, nrec * record_size, SEEK_CUR);
+  if (map_enabled)
+    {
+      map_pos += nrec * record_size;
+      offset = map_pos;
+    }
+  else if (frame_count)
+    {
+      off_t pos = (record_start_block + blocking_factor) * BLOCKSIZE;
+      offset = frame_seek (pos, pos + nrec * record_size);
+      if (offset < 0)
+	return 0;
+    }
+  else if (ring_pid)
+    {
+      /* Short skips are cheaper to read through than restarting the
+	 reader.  Otherwise, stop it and seek from the end of the current
+	 record, which is where the archive would be without it.  */
+      if (nrec < ring_slots)
+	return 0;
+      off_t pos = (record_start_block + blocking_factor) * BLOCKSIZE
+	          + nrec * record_size;
+      read_ahead_stop ();
+      offset = rmtlseek (archive, pos, SEEK_SET);
+      if (offset < 0)
+	{
+	  /* The archive is no longer where the caller expects it.  */
+	  seek_error_details (*archive_name_cursor, pos);
+	  fatal_exit ();
+	}
+    }
+  else if (archive_reader)
+    {
+      archive_uring_stop ();
+      offset = rmtlseek (archive, nrec * record_size, SEEK_CUR);
+      if (0 <= offset)
+	archive_reader_start ();
+    }
+  else
+    offset = rmtlseek (archive, nrec * record_size, SEEK_CUR);
   if (offset < 0)
     return offset;
 
@@ -1045,16 +2212,32 @@ close_archive (void)
         flush_archive ();
     }
 
+  read_ahead_stop ();
+  read_ahead_enabled = false;
+  write_behind_finish ();
+  if (!archive_uring_stop ())
+    archive_write_error (0);
+  archive_unmap_window ();
+  archive_unmap_window ();
+  map_enabled = false;
+
   compute_duration ();
   if (verify_option)
     verify_volume ();
 
+  zip_finish ();
   if (rmtclose (archive) != 0)
     close_error (*archive_name_cursor);
 
   sys_wait_for_child (child_pid, hit_eof);
 
+  if (frame_records)
+    frame_write_index ();
+  frame_records = 0;
+  frame_count = 0;
+
   tar_stat_destroy (&current_stat_info);
+  ring_free ();
   free (record_buffer[0]);
   free (record_buffer[1]);
   bufmap_free (NULL);
@@ -1302,6 +2485,8 @@ new_volume (enum access_mode mode)
     }
 
   SET_BINARY_MODE (archive);
+  if (mode == ACCESS_WRITE)
+    sys_direct_archive ();
 
   return true;
 }
@@ -1733,7 +2918,7 @@ simple_flush_read (void)
 
   for (;;)
     {
-      status = rmtread (archive, record_start->buffer, record_size);
+      status = archive_read_record ();
       if (status == record_size)
         {
           records_read++;
@@ -1792,7 +2977,7 @@ _gnu_flush_read (void)
 
   for (;;)
     {
-      status = rmtread (archive, record_start->buffer, record_size);
+      status = archive_read_record ();
       if (status == record_size)
         {
           records_read++;
@@ -1810,6 +2995,7 @@ _gnu_flush_read (void)
         {
           while (!try_new_volume ())
             ;
+          read_ahead_init ();
 	  if (current_block == record_end)
 	    /* Necessary for blocking_factor == 1 */
 	    flush_archive();
@@ -1927,6 +3113,45 @@ gnu_flush_write (size_t buffer_level)
   flush_write_ptr = gnu_flush_write;
 }
 
+/* Copy up to SIZE bytes of the file FD, open on FILE_NAME, into the
+   archive without going through the record buffer, if the buffer is
+   empty and records go straight to a local regular file.  Only whole
+   records are copied, so that the rest of the archive is the same as
+   when the file is read.  Return the number of bytes copied.  */
+off_t
+copy_to_archive (int fd, char const *file_name, off_t size)
+{
+  off_t copied = 0;
+
+  if (access_mode != ACCESS_WRITE || current_block != record_start
+      || multi_volume_option || tape_length_option
+      || dev_null_output || frame_records || archive_writer
+      || flush_write_ptr != gnu_flush_write)
+    return 0;
+
+  while (record_size <= size - copied)
+    {
+      /* Copy record by record when checkpoint actions may have to run
+	 between them.  */
+      off_t chunk = checkpoint_option ? record_size
+	: size - copied - (size - copied) % record_size;
+      off_t n = sys_copy_to_archive (fd, file_name, chunk);
+      off_t records;
+
+      for (records = n / record_size; records; records--)
+	{
+	  records_written++;
+	  checkpoint_run (true);
+	}
+      bytes_written += n;
+      record_start_block += n / BLOCKSIZE;
+      copied += n;
+      if (n != chunk)
+	break;
+    }
+  return copied;
+}
+
 void
 flush_read ()
 {
@@ -1949,6 +3174,10 @@ open_archive (enum access_mode wanted_access)
   switch (wanted_access)
     {
     case ACCESS_READ:
+      archive_uring_init ();
+      archive_map_init ();
+      read_ahead_init ();
+      /* Fall through.  */
     case ACCESS_UPDATE:
       if (volume_label_option)
         match_volume_label ();
@@ -1956,6 +3185,9 @@ open_archive (enum access_mode wanted_access)
 
     case ACCESS_WRITE:
       records_written = 0;
+      frame_write_start ();
+      write_behind_start ();
+      archive_uring_init ();
       if (volume_label_option)
         write_volume_label ();
       break;
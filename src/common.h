@@ -122,6 +122,16 @@ enum atime_preserve
 };
 GLOBAL enum atime_preserve atime_preserve_option;
 
+/* Order in which the entries of each directory are archived.  */
+enum sort_order
+{
+  no_sort,                      /* As read from the directory */
+  name_sort,                    /* By name */
+  inode_sort,                   /* By inode number */
+  extent_sort                   /* By physical position of the data */
+};
+GLOBAL enum sort_order sort_option;
+
 GLOBAL bool backup_option;
 
 /* Type of backups being made.  */
@@ -135,9 +145,29 @@ GLOBAL unsigned checkpoint_option;
 /* Specified name of compression program, or "gzip" as implied by -z.  */
 GLOBAL const char *use_compress_program_option;
 
+/* Number of processes compressing chunks of the archive in parallel,
+   or 0 to compress it as a single stream.  */
+GLOBAL uintmax_t compress_threads_option;
+
+/* Size of the chunks compressed independently with --compress-threads,
+   in kilobytes, or 0 for the default.  */
+GLOBAL uintmax_t compress_block_option;
+
+/* Size of the independently compressed frames of a seekable compressed
+   archive, in bytes, or 0 to compress the archive as a single stream.  */
+GLOBAL uintmax_t seekable_compression_option;
+#define DEFAULT_SEEKABLE_FRAME (64 * 1024 * 1024)
+
 GLOBAL bool dereference_option;
 GLOBAL bool hard_dereference_option;
 
+/* Archive files with the same contents as an earlier file as links
+   to it.  */
+GLOBAL bool deduplicate_option;
+
+/* Extract these links as copies of their targets.  */
+GLOBAL bool copy_duplicates_option;
+
 /* Print a message if not all links are dumped */
 GLOBAL int check_links_option;
 
@@ -229,6 +259,15 @@ GLOBAL bool numeric_owner_option;
 
 GLOBAL bool one_file_system_option;
 
+/* Number of processes prefetching the metadata and contents of the
+   files in each directory being archived, or 0.  */
+GLOBAL size_t prefetch_option;
+#define DEFAULT_PREFETCH 4
+
+/* Size of the memory into which these processes read the contents of
+   the files, or 0.  */
+GLOBAL size_t prefetch_size_option;
+
 /* Specified value to be put into tar file in place of stat () results, or
    just -1 if such an override should not take place.  */
 GLOBAL uid_t owner_option;
@@ -290,6 +329,24 @@ GLOBAL int verbose_option;
 
 GLOBAL bool verify_option;
 
+/* Number of records in the write-behind ring, or 0 if records are
+   written to the archive synchronously.  */
+GLOBAL size_t write_behind_option;
+#define DEFAULT_WRITE_BEHIND 8
+
+/* Write the archive bypassing the page cache, if possible.  */
+GLOBAL bool direct_io_option;
+
+/* Number of records in the read-ahead ring, or 0 if the archive is read
+   synchronously.  */
+GLOBAL size_t read_ahead_option;
+#define DEFAULT_READ_AHEAD 8
+
+/* Number of requests each file may have in progress through io_uring,
+   or 0 if files are read and written with ordinary system calls.  */
+GLOBAL size_t io_uring_option;
+#define DEFAULT_IO_URING 8
+
 /* Specified name of file containing the volume number.  */
 GLOBAL const char *volno_file_option;
 
@@ -414,8 +471,10 @@ char *drop_volume_label_suffix (const char *label);
 size_t available_space_after (union block *pointer);
 off_t current_block_ordinal (void);
 void close_archive (void);
+void close_archive_descriptors (void);
 void closeout_volume_number (void);
 void compute_duration (void);
+off_t copy_to_archive (int fd, char const *file_name, off_t size);
 union block *find_next_block (void);
 void flush_read (void);
 void flush_write (void);
@@ -456,7 +515,18 @@ enum dump_status
 void add_exclusion_tag (const char *name, enum exclusion_tag_type type,
 			bool (*predicate) (int));
 bool cachedir_file_p (int fd);
-char *get_directory_entries (struct tar_stat_info *st);
+/* The type of the directory entry DP, as a DT_* value.  */
+#ifdef DT_UNKNOWN
+# define DIRENT_TYPE(dp) ((dp)->d_type)
+#else
+# define DT_UNKNOWN 0
+# define DT_DIR 4
+# define DT_REG 8
+# define DT_LNK 10
+# define DIRENT_TYPE(dp) DT_UNKNOWN
+#endif
+
+char *get_directory_entries (struct tar_stat_info *st, unsigned char **types);
 
 void create_archive (void);
 void pad_archive (off_t size_left);
@@ -471,11 +541,13 @@ union block * write_extended (bool global, struct tar_stat_info *st,
 union block *start_private_header (const char *name, size_t size, time_t t);
 void write_eot (void);
 void check_links (void);
+size_t link_table_memory (void);
 int subfile_open (struct tar_stat_info const *dir, char const *file, int flags);
 void restore_parent_fd (struct tar_stat_info const *st);
 void exclusion_tag_warning (const char *dirname, const char *tagname,
 			    const char *message);
 enum exclusion_tag_type check_exclusion_tags (struct tar_stat_info const *st,
+					      char const *entries,
 					      const char **tag_file_name);
 
 #define OFF_TO_CHARS(val, where) off_to_chars (val, where, sizeof (where))
@@ -571,6 +643,7 @@ void read_and (void (*do_something) (void));
 enum read_header read_header (union block **return_block,
 			      struct tar_stat_info *info,
 			      enum read_header_mode m);
+unsigned int block_sum (union block const *block, int *signed_sum);
 enum read_header tar_checksum (union block *header, bool silent);
 void skip_file (off_t size);
 void skip_member (void);
@@ -615,6 +688,31 @@ int remove_any_file (const char *file_name, enum remove_option option);
 bool maybe_backup_file (const char *file_name, bool this_is_the_archive);
 void undo_last_backup (void);
 
+/* Fields of the status of a file requested from stat_at and stat_fd.
+   Where statx is missing, all of them are always filled in.  */
+#if defined STATX_BASIC_STATS && defined AT_EMPTY_PATH
+# define USE_STATX 1
+#else
+# define USE_STATX 0
+#endif
+#ifndef STATX_BASIC_STATS
+# define STATX_TYPE 0x0001U
+# define STATX_MODE 0x0002U
+# define STATX_NLINK 0x0004U
+# define STATX_UID 0x0008U
+# define STATX_GID 0x0010U
+# define STATX_ATIME 0x0020U
+# define STATX_MTIME 0x0040U
+# define STATX_CTIME 0x0080U
+# define STATX_INO 0x0100U
+# define STATX_SIZE 0x0200U
+# define STATX_BLOCKS 0x0400U
+# define STATX_BASIC_STATS 0x07ffU
+#endif
+
+int stat_at (int dirfd, char const *name, struct stat *buf, int flags,
+	     unsigned int mask);
+int stat_fd (int fd, struct stat *buf, unsigned int mask);
 int deref_stat (char const *name, struct stat *buf);
 
 extern int chdir_current;
@@ -643,6 +741,7 @@ void xpipe (int fd[2]);
 void *page_aligned_alloc (void **ptr, size_t size);
 int set_file_atime (int fd, int parentfd, char const *file,
 		    struct timespec atime);
+off_t advise_sequential_read (int fd, off_t offset, off_t advised);
 
 /* Module names.c.  */
 
@@ -653,6 +752,7 @@ void gid_to_gname (gid_t gid, char **gname);
 int gname_to_gid (char const *gname, gid_t *pgid);
 void uid_to_uname (uid_t uid, char **uname);
 int uname_to_uid (char const *uname, uid_t *puid);
+void read_id_file (char const *file_name, bool group);
 
 void name_init (void);
 void name_add_name (const char *name, int matching_flags);
@@ -733,15 +833,18 @@ char *xheader_format_name (struct tar_stat_info *st, const char *fmt,
 void sys_detect_dev_null_output (void);
 void sys_save_archive_dev_ino (void);
 void sys_wait_for_child (pid_t, bool);
+void sys_stop_child (pid_t);
 void sys_spawn_shell (void);
 bool sys_compare_uid (struct stat *a, struct stat *b);
 bool sys_compare_gid (struct stat *a, struct stat *b);
 bool sys_file_is_archive (struct tar_stat_info *p);
 bool sys_compare_links (struct stat *link_data, struct stat *stat_data);
 int sys_truncate (int fd);
-pid_t sys_child_open_for_compress (void);
-pid_t sys_child_open_for_uncompress (void);
+pid_t sys_child_open_for_compress (bool append);
+pid_t sys_child_open_for_uncompress (off_t offset);
 size_t sys_write_archive_buffer (void);
+void sys_direct_archive (void);
+off_t sys_copy_to_archive (int fd, char const *file_name, off_t size);
 bool sys_get_archive_stat (void);
 int sys_exec_command (char *file_name, int typechar, struct tar_stat_info *st);
 void sys_wait_command (void);
@@ -750,6 +853,32 @@ void sys_exec_checkpoint_script (const char *script_name,
 				 const char *archive_name,
 				 int checkpoint_number);
 
+/* Module compress.c */
+
+bool zip_active (void);
+bool zip_start (char const *program, bool compress);
+size_t zip_write (char const *buf, size_t size);
+off_t zip_next_stream (void);
+size_t zip_read (char *buf, size_t size);
+bool zip_seek (off_t offset);
+void zip_disown (void);
+void zip_finish (void);
+void zip_close_descriptors (void);
+
+/* Module uring.c */
+
+/* Size of the requests on member files.  */
+enum { URING_CHUNK = 256 * 1024 };
+
+struct uring_stream;
+struct uring_stream *uring_open_read (int fd, off_t offset, off_t size,
+				      size_t chunk);
+struct uring_stream *uring_open_write (int fd, off_t offset, size_t chunk);
+size_t uring_read (struct uring_stream *s, char *buf, size_t size);
+off_t uring_tell (struct uring_stream *s);
+bool uring_write (struct uring_stream *s, char const *buf, size_t size);
+bool uring_close (struct uring_stream *s);
+
 /* Module compare.c */
 void report_difference (struct tar_stat_info *st, const char *message, ...);
 
@@ -761,6 +890,7 @@ enum dump_status sparse_extract_file (int fd, struct tar_stat_info *st,
 				      off_t *size);
 enum dump_status sparse_skip_file (struct tar_stat_info *st);
 bool sparse_diff_file (int, struct tar_stat_info *st);
+size_t sparse_write (int fd, char const *buffer, size_t count, bool *hole);
 
 /* Module utf8.c */
 bool string_ascii_p (const char *str);
@@ -151,7 +151,11 @@ read_and_process (struct tar_stat_info *st, int (*processor) (size_t, char *))
 static int
 get_stat_data (char const *file_name, struct stat *stat_data)
 {
-  int status = deref_stat (file_name, stat_data);
+  int status = stat_at (chdir_fd, file_name, stat_data, fstatat_flags,
+			(STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID
+			 | STATX_INO | STATX_MTIME | STATX_SIZE
+			 | (atime_preserve_option == replace_atime_preserve
+			    ? STATX_ATIME : 0)));
 
   if (status != 0)
     {
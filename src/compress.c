@@ -0,0 +1,1061 @@
+/* In-process compression and decompression for tar.
+
+   Copyright (C) 2011 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+   Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* When tar is built with the library of a compression program, it
+   compresses and decompresses the archive itself, instead of running
+   the program in a child process and passing every record through a
+   pipe.  The archive is then read and written directly, which lets
+   tar seek in compressed archives that have a frame index, start a
+   new frame of such an archive without starting another compressor,
+   and report errors in the compressed data itself.
+
+   The programs are still used for the compressions that have no
+   library here, for --use-compress-program with another program or
+   with options, and when the environment passes options to the
+   program, such as GZIP=-9.  */
+
+#include <system.h>
+#include <quotearg.h>
+
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#if HAVE_LIBZ && HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+#if HAVE_LIBBZ2 && HAVE_BZLIB_H
+# include <bzlib.h>
+#endif
+#if HAVE_LIBLZMA && HAVE_LZMA_H
+# include <lzma.h>
+#endif
+#if HAVE_LIBZSTD && HAVE_ZSTD_H
+# include <zstd.h>
+#endif
+
+#include "common.h"
+#include <rmt.h>
+
+enum zip_status
+{
+  zip_ok,                       /* Progress was made, or more data is
+				   needed */
+  zip_stream_end,               /* The end of a stream was reached */
+  zip_error                     /* The data is corrupt */
+};
+
+/* A compression library.  Each function works on the buffers described
+   by zip_next_in, zip_avail_in, zip_next_out and zip_avail_out.  */
+struct zip_codec
+{
+  char const *program;          /* Program it replaces */
+  char const *envar;            /* Environment variable giving options
+				   to the program */
+  void (*init) (bool compress); /* Start a stream */
+  enum zip_status (*code) (bool finish); /* Process the buffers, ending
+				   the stream if FINISH */
+  void (*end) (void);           /* Free the stream */
+  bool concatenable;            /* Do streams one after the other
+				   decompress as a single one? */
+};
+
+/* Input and output buffers of the codecs.  */
+static char const *zip_next_in;
+static size_t zip_avail_in;
+static char *zip_next_out;
+static size_t zip_avail_out;
+
+/* Description of the last zip_error.  */
+static char const *zip_message;
+
+/* Whether the current stream compresses.  */
+static bool zip_compress;
+
+#if HAVE_LIBZ && HAVE_ZLIB_H
+static z_stream gzip_stream;
+
+static void
+gzip_init (bool compress)
+{
+  int rc;
+
+  memset (&gzip_stream, 0, sizeof gzip_stream);
+  /* 16 more bits of window size select the gzip format.  */
+  rc = (compress
+	? deflateInit2 (&gzip_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			15 + 16, 8, Z_DEFAULT_STRATEGY)
+	: inflateInit2 (&gzip_stream, 15 + 16));
+  if (rc != Z_OK)
+    xalloc_die ();
+}
+
+static enum zip_status
+gzip_code (bool finish)
+{
+  int rc;
+
+  gzip_stream.next_in = (Bytef *) zip_next_in;
+  gzip_stream.avail_in = zip_avail_in;
+  gzip_stream.next_out = (Bytef *) zip_next_out;
+  gzip_stream.avail_out = zip_avail_out;
+  rc = (zip_compress
+	? deflate (&gzip_stream, finish ? Z_FINISH : Z_NO_FLUSH)
+	: inflate (&gzip_stream, Z_NO_FLUSH));
+  zip_next_in = (char const *) gzip_stream.next_in;
+  zip_avail_in = gzip_stream.avail_in;
+  zip_next_out = (char *) gzip_stream.next_out;
+  zip_avail_out = gzip_stream.avail_out;
+
+  switch (rc)
+    {
+    case Z_OK:
+    case Z_BUF_ERROR:
+      return zip_ok;
+
+    case Z_STREAM_END:
+      return zip_stream_end;
+
+    case Z_MEM_ERROR:
+      xalloc_die ();
+
+    default:
+      zip_message = gzip_stream.msg ? gzip_stream.msg : _("Invalid data");
+      return zip_error;
+    }
+}
+
+static void
+gzip_end (void)
+{
+  if (zip_compress)
+    deflateEnd (&gzip_stream);
+  else
+    inflateEnd (&gzip_stream);
+}
+#endif
+
+#if HAVE_LIBBZ2 && HAVE_BZLIB_H
+static bz_stream bzip2_stream;
+
+static void
+bzip2_init (bool compress)
+{
+  int rc;
+
+  memset (&bzip2_stream, 0, sizeof bzip2_stream);
+  /* Blocks of 900 kB, as bzip2 makes by default.  */
+  rc = (compress
+	? BZ2_bzCompressInit (&bzip2_stream, 9, 0, 0)
+	: BZ2_bzDecompressInit (&bzip2_stream, 0, 0));
+  if (rc != BZ_OK)
+    xalloc_die ();
+}
+
+static enum zip_status
+bzip2_code (bool finish)
+{
+  int rc;
+
+  bzip2_stream.next_in = (char *) zip_next_in;
+  bzip2_stream.avail_in = zip_avail_in;
+  bzip2_stream.next_out = zip_next_out;
+  bzip2_stream.avail_out = zip_avail_out;
+  rc = (zip_compress
+	? BZ2_bzCompress (&bzip2_stream, finish ? BZ_FINISH : BZ_RUN)
+	: BZ2_bzDecompress (&bzip2_stream));
+  zip_next_in = bzip2_stream.next_in;
+  zip_avail_in = bzip2_stream.avail_in;
+  zip_next_out = bzip2_stream.next_out;
+  zip_avail_out = bzip2_stream.avail_out;
+
+  switch (rc)
+    {
+    case BZ_OK:
+    case BZ_RUN_OK:
+    case BZ_FINISH_OK:
+      return zip_ok;
+
+    case BZ_STREAM_END:
+      return zip_stream_end;
+
+    case BZ_MEM_ERROR:
+      xalloc_die ();
+
+    default:
+      zip_message = _("Invalid data");
+      return zip_error;
+    }
+}
+
+static void
+bzip2_end (void)
+{
+  if (zip_compress)
+    BZ2_bzCompressEnd (&bzip2_stream);
+  else
+    BZ2_bzDecompressEnd (&bzip2_stream);
+}
+#endif
+
+#if HAVE_LIBLZMA && HAVE_LZMA_H
+static lzma_stream xz_stream = LZMA_STREAM_INIT;
+
+/* Compression preset used by default by xz and lzma.  */
+enum { XZ_PRESET = 6 };
+
+static void
+xz_check_init (lzma_ret rc)
+{
+  if (rc != LZMA_OK)
+    xalloc_die ();
+}
+
+static void
+xz_init (bool compress)
+{
+  xz_check_init (compress
+		 ? lzma_easy_encoder (&xz_stream, XZ_PRESET, LZMA_CHECK_CRC64)
+		 : lzma_stream_decoder (&xz_stream, UINT64_MAX, 0));
+}
+
+static void
+lzma_init (bool compress)
+{
+  if (compress)
+    {
+      lzma_options_lzma options;
+      if (lzma_lzma_preset (&options, XZ_PRESET))
+	xalloc_die ();
+      xz_check_init (lzma_alone_encoder (&xz_stream, &options));
+    }
+  else
+    xz_check_init (lzma_alone_decoder (&xz_stream, UINT64_MAX));
+}
+
+static enum zip_status
+xz_code (bool finish)
+{
+  lzma_ret rc;
+
+  xz_stream.next_in = (uint8_t const *) zip_next_in;
+  xz_stream.avail_in = zip_avail_in;
+  xz_stream.next_out = (uint8_t *) zip_next_out;
+  xz_stream.avail_out = zip_avail_out;
+  rc = lzma_code (&xz_stream, finish ? LZMA_FINISH : LZMA_RUN);
+  zip_next_in = (char const *) xz_stream.next_in;
+  zip_avail_in = xz_stream.avail_in;
+  zip_next_out = (char *) xz_stream.next_out;
+  zip_avail_out = xz_stream.avail_out;
+
+  switch (rc)
+    {
+    case LZMA_OK:
+    case LZMA_BUF_ERROR:
+      return zip_ok;
+
+    case LZMA_STREAM_END:
+      return zip_stream_end;
+
+    case LZMA_MEM_ERROR:
+      xalloc_die ();
+
+    case LZMA_FORMAT_ERROR:
+      zip_message = _("Not in the expected format");
+      return zip_error;
+
+    case LZMA_OPTIONS_ERROR:
+      zip_message = _("Unsupported options");
+      return zip_error;
+
+    default:
+      zip_message = _("Invalid data");
+      return zip_error;
+    }
+}
+
+static void
+xz_end (void)
+{
+  lzma_end (&xz_stream);
+}
+#endif
+
+#if HAVE_LIBZSTD && HAVE_ZSTD_H
+static ZSTD_CCtx *zstd_cctx;
+static ZSTD_DCtx *zstd_dctx;
+
+static void
+zstd_init (bool compress)
+{
+  if (compress)
+    {
+      if (!zstd_cctx && ! (zstd_cctx = ZSTD_createCCtx ()))
+	xalloc_die ();
+      ZSTD_CCtx_reset (zstd_cctx, ZSTD_reset_session_and_parameters);
+    }
+  else
+    {
+      if (!zstd_dctx && ! (zstd_dctx = ZSTD_createDCtx ()))
+	xalloc_die ();
+      ZSTD_DCtx_reset (zstd_dctx, ZSTD_reset_session_and_parameters);
+    }
+}
+
+static enum zip_status
+zstd_code (bool finish)
+{
+  ZSTD_inBuffer in;
+  ZSTD_outBuffer out;
+  size_t rc;
+
+  in.src = zip_next_in;
+  in.size = zip_avail_in;
+  in.pos = 0;
+  out.dst = zip_next_out;
+  out.size = zip_avail_out;
+  out.pos = 0;
+  rc = (zip_compress
+	? ZSTD_compressStream2 (zstd_cctx, &out, &in,
+				finish ? ZSTD_e_end : ZSTD_e_continue)
+	: ZSTD_decompressStream (zstd_dctx, &out, &in));
+  zip_next_in += in.pos;
+  zip_avail_in -= in.pos;
+  zip_next_out += out.pos;
+  zip_avail_out -= out.pos;
+
+  if (ZSTD_isError (rc))
+    {
+      zip_message = ZSTD_getErrorName (rc);
+      return zip_error;
+    }
+  /* Zero means that the frame is complete, or, when compressing, that
+     it is flushed.  */
+  return rc == 0 && (finish || !zip_compress) ? zip_stream_end : zip_ok;
+}
+
+static void
+zstd_end (void)
+{
+}
+#endif
+
+static struct zip_codec const zip_codecs[] = {
+#if HAVE_LIBZ && HAVE_ZLIB_H
+  { GZIP_PROGRAM,  "GZIP",        gzip_init,  gzip_code,  gzip_end,  true },
+#endif
+#if HAVE_LIBBZ2 && HAVE_BZLIB_H
+  { BZIP2_PROGRAM, "BZIP2",       bzip2_init, bzip2_code, bzip2_end, true },
+#endif
+#if HAVE_LIBLZMA && HAVE_LZMA_H
+  { XZ_PROGRAM,    "XZ_OPT",      xz_init,    xz_code,    xz_end,    true },
+  { LZMA_PROGRAM,  "XZ_OPT",      lzma_init,  xz_code,    xz_end,    false },
+#endif
+#if HAVE_LIBZSTD && HAVE_ZSTD_H
+  { ZSTD_PROGRAM,  "ZSTD_CLEVEL", zstd_init,  zstd_code,  zstd_end,  true },
+#endif
+  { NULL }
+};
+
+/* The codec in use, or NULL.  */
+static struct zip_codec const *zip_codec;
+
+/* Buffer of compressed data, of record_size bytes, and the number of
+   bytes in it.  */
+static char *zip_buffer;
+static size_t zip_fill;
+
+/* Number of bytes of compressed data written to the archive.  */
+static off_t zip_output;
+
+/* Whether compressed data is written in whole records, and whether
+   this is known yet.  */
+static bool zip_reblock;
+static bool zip_reblock_known;
+
+/* When decompressing: whether the end of the archive was read, whether
+   the end of the compressed data was found, the number of streams
+   decompressed, and whether the current one has begun.  Compressed data
+   is not expected to produce output right away, so only the last tells
+   whether padding between two streams may follow.  */
+static bool zip_eof;
+static bool zip_done;
+static size_t zip_streams;
+static bool zip_stream_begun;
+
+/* Whether a helper process has taken over the codec.  */
+static bool zip_disowned;
+
+/* Whether the data is compressed in chunks, with --compress-threads.  */
+static bool zip_parallel;
+
+static bool zip_parallel_start (char const *program);
+
+/* Return true if the archive is compressed or decompressed in-process.  */
+bool
+zip_active (void)
+{
+  return !!zip_codec;
+}
+
+/* Prepare to compress the archive with PROGRAM if COMPRESS, or else to
+   decompress it, in-process.  Return false if PROGRAM must be run
+   instead.  The archive is to be opened afterwards.  */
+bool
+zip_start (char const *program, bool compress)
+{
+  struct zip_codec const *p;
+
+  zip_codec = NULL;
+  if (!program)
+    return false;
+  for (p = zip_codecs; p->program; p++)
+    if (strcmp (p->program, program) == 0)
+      break;
+  if (compress)
+    {
+      char const *options = p->program ? getenv (p->envar) : NULL;
+      if (!p->program || (options && *options))
+	{
+	  zip_parallel_start (NULL);
+	  return false;
+	}
+    }
+  else if (!p->program)
+    return false;
+
+  zip_codec = p;
+  zip_compress = compress;
+  zip_parallel = compress && zip_parallel_start (program);
+  if (!zip_parallel)
+    zip_codec->init (compress);
+  zip_buffer = xmalloc (record_size);
+  zip_fill = 0;
+  zip_output = 0;
+  zip_reblock_known = false;
+  zip_avail_in = 0;
+  zip_eof = zip_done = false;
+  zip_streams = 0;
+  zip_stream_begun = false;
+  zip_disowned = false;
+  return true;
+}
+
+/* Write out the compressed data in zip_buffer.  As with the
+   compression programs, devices and remote archives get whole records,
+   while other files get the compressed data as is.  Return false on
+   error, with the status of the write in *STATUS.  */
+static bool
+zip_flush (size_t *status)
+{
+  size_t size = zip_fill;
+
+  if (!zip_reblock_known)
+    {
+      struct stat st;
+      zip_reblock = (_isrmt (archive)
+		     || fstat (archive, &st) != 0
+		     || S_ISCHR (st.st_mode) || S_ISBLK (st.st_mode));
+      zip_reblock_known = true;
+    }
+  if (zip_reblock && size < record_size)
+    {
+      memset (zip_buffer + size, 0, record_size - size);
+      size = record_size;
+    }
+  *status = rmtwrite (archive, zip_buffer, size);
+  if (*status != size)
+    return false;
+  zip_fill = 0;
+  zip_output += size;
+  return true;
+}
+
+/* Compress the input, ending the stream if FINISH, and write out every
+   record of compressed data filled.  Return false on write error,
+   with the status of the write in *STATUS.  */
+static bool
+zip_deflate (bool finish, size_t *status)
+{
+  enum zip_status rc;
+
+  do
+    {
+      zip_next_out = zip_buffer + zip_fill;
+      zip_avail_out = record_size - zip_fill;
+      rc = zip_codec->code (finish);
+      zip_fill = record_size - zip_avail_out;
+      if (rc == zip_error)
+	FATAL_ERROR ((0, 0, _("Compression failed: %s"), zip_message));
+      if (zip_fill == record_size && !zip_flush (status))
+	return false;
+    }
+  while (finish ? rc != zip_stream_end : zip_avail_in || !zip_avail_out);
+  return true;
+}
+
+/* Append the SIZE bytes of compressed data in BUF to zip_buffer,
+   writing out every record filled.  Return false on write error, with
+   the status of the write in *STATUS.  */
+static bool
+zip_put (char const *buf, size_t size, size_t *status)
+{
+  while (size)
+    {
+      size_t n = record_size - zip_fill;
+      if (size < n)
+	n = size;
+      memcpy (zip_buffer + zip_fill, buf, n);
+      zip_fill += n;
+      buf += n;
+      size -= n;
+      if (zip_fill == record_size && !zip_flush (status))
+	return false;
+    }
+  return true;
+}
+
+/* Parallel compression.  With --compress-threads, the data is cut into
+   chunks of --compress-block-size bytes, each of which is compressed
+   as a stream of its own: a gzip member, a bzip2 or xz stream, or a
+   zstd frame.  The programs, like tar, decompress a series of streams
+   as the concatenation of their contents.  Chunks are compressed by as
+   many worker processes as threads were asked for, in slots of memory
+   shared with tar, which writes out the compressed chunks in order.
+   Since the chunks do not depend on the number of workers, neither
+   does the archive: with a single thread, tar compresses the same
+   chunks itself.  A new frame of a seekable compressed archive starts
+   a new chunk.  */
+
+#if HAVE_SYS_MMAN_H && defined MAP_SHARED && defined MAP_ANONYMOUS
+# define HAVE_ZIP_WORKERS 1
+#else
+# define HAVE_ZIP_WORKERS 0
+#endif
+
+/* Size of the chunks when --compress-block-size is not given.  */
+enum { ZIP_DEFAULT_CHUNK = 1024 * 1024 };
+
+/* A chunk passed to a worker: the slot holding it and the size of its
+   data.  The worker replies with the size of the compressed data, or
+   SIZE_MAX if it could not compress it.  A slot of SIZE_MAX tells the
+   worker to exit.  */
+struct zip_job
+{
+  size_t slot;
+  size_t size;
+};
+
+static size_t zip_chunk;        /* Size of the chunks */
+static size_t zip_bound;        /* Room for a compressed chunk */
+static char *zip_pool;          /* Slots, each a chunk followed by room
+				   for its compressed data */
+static size_t zip_slots;        /* Number of slots */
+static bool zip_pool_shared;    /* Is the pool mapped shared memory? */
+static size_t *zip_result;      /* Size of the compressed data of each
+				   slot, or SIZE_MAX while a worker has it */
+static size_t zip_oldest;       /* Oldest slot not written out */
+static size_t zip_pending;      /* Number of slots compressed, or being
+				   compressed, and not written out */
+static size_t zip_slot_fill;    /* Bytes in the slot being filled, which
+				   follows the pending ones */
+static pid_t *zip_worker_pid;   /* Workers */
+static size_t zip_workers;      /* Number of workers, 0 if tar compresses
+				   the chunks itself */
+static pid_t zip_workers_parent; /* Process that started them */
+static int zip_job_fd;          /* Chunks, from tar to the workers */
+static int zip_reply_fd;        /* Replies, from the workers to tar */
+
+/* Return slot number SLOT.  */
+static char *
+zip_slot (size_t slot)
+{
+  return zip_pool + slot * (zip_chunk + zip_bound);
+}
+
+/* Compress the SIZE bytes of IN as a whole stream into OUT, which has
+   room for zip_bound bytes.  Return the size of the compressed data,
+   or SIZE_MAX on failure, with zip_message set.  */
+static size_t
+zip_compress_chunk (char const *in, size_t size, char *out)
+{
+  enum zip_status rc;
+
+  zip_codec->init (true);
+  zip_next_in = in;
+  zip_avail_in = size;
+  zip_next_out = out;
+  zip_avail_out = zip_bound;
+  do
+    rc = zip_codec->code (true);
+  while (rc == zip_ok && zip_avail_out);
+  zip_codec->end ();
+
+  if (rc == zip_stream_end)
+    return zip_bound - zip_avail_out;
+  if (rc == zip_ok)
+    zip_message = _("Compressed data too large");
+  return SIZE_MAX;
+}
+
+/* Read a job or a reply from FD into JOB.  Return false at end of
+   file.  */
+static bool
+zip_job_read (int fd, struct zip_job *job)
+{
+  char *p = (char *) job;
+  size_t size = sizeof *job;
+
+  while (size)
+    {
+      size_t n = safe_read (fd, p, size);
+      if (n == SAFE_READ_ERROR || n == 0)
+	return false;
+      p += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* Main loop of a worker process.  */
+static void zip_worker (void) __attribute__ ((noreturn));
+
+static void
+zip_worker (void)
+{
+  struct zip_job job;
+
+  set_program_name (_("tar (compressor)"));
+  while (zip_job_read (zip_job_fd, &job) && job.slot != SIZE_MAX)
+    {
+      char *p = zip_slot (job.slot);
+      job.size = zip_compress_chunk (p, job.size, p + zip_chunk);
+      if (full_write (zip_reply_fd, &job, sizeof job) != sizeof job)
+	break;
+    }
+  /* Do not run the exit hooks: the output streams belong to tar.  */
+  _exit (0);
+}
+
+/* Start the workers, and let them share the pool.  Return false if
+   the pool cannot be shared.  */
+static bool
+zip_workers_start (size_t workers)
+{
+#if HAVE_ZIP_WORKERS
+  size_t slot_size = zip_chunk + zip_bound;
+  int job_pipe[2];
+  int reply_pipe[2];
+  size_t size;
+  void *ptr;
+  size_t i;
+
+  zip_slots = 2 * workers;
+  size = zip_slots * slot_size;
+  if (size / slot_size != zip_slots)
+    xalloc_die ();
+  ptr = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+	      -1, 0);
+  if (ptr == MAP_FAILED)
+    {
+      WARN ((0, errno, _("Cannot allocate shared compression buffers")));
+      return false;
+    }
+  zip_pool = ptr;
+  zip_pool_shared = true;
+
+  xpipe (job_pipe);
+  xpipe (reply_pipe);
+  zip_worker_pid = xnmalloc (workers, sizeof *zip_worker_pid);
+  for (i = 0; i < workers; i++)
+    {
+      zip_worker_pid[i] = xfork ();
+      if (zip_worker_pid[i] == 0)
+	{
+	  xclose (job_pipe[1]);
+	  xclose (reply_pipe[0]);
+	  zip_job_fd = job_pipe[0];
+	  zip_reply_fd = reply_pipe[1];
+	  zip_worker ();
+	}
+    }
+  xclose (job_pipe[0]);
+  xclose (reply_pipe[1]);
+  zip_job_fd = job_pipe[1];
+  zip_reply_fd = reply_pipe[0];
+  fcntl (zip_job_fd, F_SETFD, FD_CLOEXEC);
+  fcntl (zip_reply_fd, F_SETFD, FD_CLOEXEC);
+  zip_workers = workers;
+  zip_workers_parent = getpid ();
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Decide whether the archive, to be compressed by PROGRAM, or by an
+   external program if PROGRAM is NULL, is compressed in chunks, and
+   get ready to do it.  Warn, once, about the options that cannot be
+   honored.  */
+static bool
+zip_parallel_start (char const *program)
+{
+  static bool warned;
+
+  if (!compress_threads_option)
+    {
+      if (compress_block_option && !warned)
+	WARN ((0, 0, _("--compress-block-size ignored:"
+		       " it needs --compress-threads")));
+      warned = true;
+      return false;
+    }
+  if (!program || !zip_codec->concatenable)
+    {
+      if (warned)
+	;
+      else if (!program)
+	WARN ((0, 0, _("--compress-threads ignored: %s is run as a"
+		       " separate program"),
+	       quote (use_compress_program_option)));
+      else
+	WARN ((0, 0, _("--compress-threads ignored: %s archives cannot"
+		       " be made of several streams"), program));
+      warned = true;
+      return false;
+    }
+
+  zip_chunk = (compress_block_option ? compress_block_option * 1024
+	       : ZIP_DEFAULT_CHUNK);
+  /* More than any of the codecs needs for data that does not
+     compress.  */
+  zip_bound = zip_chunk + zip_chunk / 64 + 4096;
+  zip_pool_shared = false;
+  zip_workers = 0;
+  if (! (1 < compress_threads_option
+	 && zip_workers_start (compress_threads_option)))
+    {
+      zip_slots = 1;
+      zip_pool = xmalloc (zip_chunk + zip_bound);
+    }
+  zip_result = xnmalloc (zip_slots, sizeof *zip_result);
+  zip_oldest = zip_pending = zip_slot_fill = 0;
+  return true;
+}
+
+/* Wait until the oldest pending slot is compressed, and write out its
+   compressed data.  Return false on write error, with the status of
+   the write in *STATUS.  */
+static bool
+zip_retire (size_t *status)
+{
+  size_t slot = zip_oldest;
+
+  while (zip_result[slot] == SIZE_MAX)
+    {
+      struct zip_job reply;
+      if (!zip_job_read (zip_reply_fd, &reply))
+	FATAL_ERROR ((0, 0, _("Compression worker exited unexpectedly")));
+      if (reply.size == SIZE_MAX)
+	FATAL_ERROR ((0, 0, _("Compression failed in a worker process")));
+      zip_result[reply.slot] = reply.size;
+    }
+  zip_oldest = (slot + 1) % zip_slots;
+  zip_pending--;
+  return zip_put (zip_slot (slot) + zip_chunk, zip_result[slot], status);
+}
+
+/* Compress the slot being filled, or pass it to a worker, and make the
+   next slot the one being filled, writing out the oldest pending one
+   if there is no free slot left.  Return false on write error, with
+   the status of the write in *STATUS.  */
+static bool
+zip_submit (size_t *status)
+{
+  size_t slot = (zip_oldest + zip_pending) % zip_slots;
+  char *p = zip_slot (slot);
+
+  if (zip_workers)
+    {
+      struct zip_job job;
+      job.slot = slot;
+      job.size = zip_slot_fill;
+      zip_result[slot] = SIZE_MAX;
+      if (full_write (zip_job_fd, &job, sizeof job) != sizeof job)
+	FATAL_ERROR ((0, errno, _("Cannot pass data to compression worker")));
+    }
+  else
+    {
+      zip_result[slot] = zip_compress_chunk (p, zip_slot_fill, p + zip_chunk);
+      if (zip_result[slot] == SIZE_MAX)
+	FATAL_ERROR ((0, 0, _("Compression failed: %s"), zip_message));
+    }
+  zip_slot_fill = 0;
+  return ++zip_pending < zip_slots || zip_retire (status);
+}
+
+/* Copy the SIZE bytes of BUF into the slots, compressing every chunk
+   filled.  Return false on write error, with the status of the write
+   in *STATUS.  */
+static bool
+zip_parallel_write (char const *buf, size_t size, size_t *status)
+{
+  while (size)
+    {
+      char *p = zip_slot ((zip_oldest + zip_pending) % zip_slots);
+      size_t n = zip_chunk - zip_slot_fill;
+      if (size < n)
+	n = size;
+      memcpy (p + zip_slot_fill, buf, n);
+      zip_slot_fill += n;
+      buf += n;
+      size -= n;
+      if (zip_slot_fill == zip_chunk && !zip_submit (status))
+	return false;
+    }
+  return true;
+}
+
+/* End the current chunk, and write out every pending one.  Return
+   false on write error, with the status of the write in *STATUS.  */
+static bool
+zip_parallel_end (size_t *status)
+{
+  if (zip_slot_fill && !zip_submit (status))
+    return false;
+  while (zip_pending)
+    if (!zip_retire (status))
+      return false;
+  return true;
+}
+
+/* Tell the workers, if this process is the one that passes them the
+   chunks, that there is no more work.  Wait for them to exit if they
+   are its children, and free the slots.  */
+static void
+zip_parallel_stop (void)
+{
+  if (zip_workers)
+    {
+      size_t i;
+
+      if (!zip_disowned)
+	for (i = 0; i < zip_workers; i++)
+	  {
+	    struct zip_job job;
+	    job.slot = SIZE_MAX;
+	    job.size = 0;
+	    if (full_write (zip_job_fd, &job, sizeof job) != sizeof job)
+	      break;
+	  }
+      close (zip_job_fd);
+      close (zip_reply_fd);
+      if (getpid () == zip_workers_parent)
+	for (i = 0; i < zip_workers; i++)
+	  while (waitpid (zip_worker_pid[i], NULL, 0) < 0 && errno == EINTR)
+	    continue;
+      free (zip_worker_pid);
+      zip_worker_pid = NULL;
+      zip_workers = 0;
+    }
+#if HAVE_ZIP_WORKERS
+  if (zip_pool_shared)
+    munmap (zip_pool, zip_slots * (zip_chunk + zip_bound));
+  else
+#endif
+    free (zip_pool);
+  zip_pool = NULL;
+  free (zip_result);
+  zip_result = NULL;
+}
+
+/* In a helper process forked by tar, close the descriptors leading to
+   the compression workers, so that they are not kept open.  */
+void
+zip_close_descriptors (void)
+{
+  if (zip_workers)
+    {
+      close (zip_job_fd);
+      close (zip_reply_fd);
+    }
+}
+
+/* Compress the SIZE bytes of BUF into the archive.  Return SIZE, or
+   the status of the failing write.  */
+size_t
+zip_write (char const *buf, size_t size)
+{
+  size_t status;
+
+  if (zip_parallel)
+    return zip_parallel_write (buf, size, &status) ? size : status;
+  zip_next_in = buf;
+  zip_avail_in = size;
+  return zip_deflate (false, &status) ? size : status;
+}
+
+/* End the compressed stream and start a new one, which can then be
+   decompressed on its own.  Return the offset of the new stream in the
+   archive.  */
+off_t
+zip_next_stream (void)
+{
+  size_t status;
+
+  zip_avail_in = 0;
+  if (! (zip_parallel ? zip_parallel_end (&status)
+	 : zip_deflate (true, &status))
+      || (zip_fill && !zip_flush (&status)))
+    archive_write_error (status);
+  if (!zip_parallel)
+    {
+      zip_codec->end ();
+      zip_codec->init (true);
+    }
+  return zip_output;
+}
+
+/* Decompress into BUF up to SIZE bytes of the archive.  Return the
+   number of bytes decompressed, which is 0 at the end of the data, or
+   SAFE_READ_ERROR if the archive could not be read.  */
+size_t
+zip_read (char *buf, size_t size)
+{
+  zip_next_out = buf;
+  zip_avail_out = size;
+
+  while (zip_avail_out && !zip_done)
+    {
+      size_t before = zip_avail_out;
+      size_t input;
+      enum zip_status rc;
+
+      if (!zip_avail_in && !zip_eof)
+	{
+	  size_t status = rmtread (archive, zip_buffer, record_size);
+	  if (status == SAFE_READ_ERROR)
+	    {
+	      if (zip_avail_out == size)
+		return status;
+	      break;
+	    }
+	  zip_next_in = zip_buffer;
+	  zip_avail_in = status;
+	  zip_eof = status == 0;
+	}
+
+      if (zip_streams && !zip_stream_begun)
+	{
+	  /* Between two streams.  Skip the padding that devices get and
+	     that some formats allow.  */
+	  while (zip_avail_in && !*zip_next_in)
+	    zip_next_in++, zip_avail_in--;
+	  if (!zip_avail_in)
+	    {
+	      zip_done = zip_eof;
+	      continue;
+	    }
+	}
+
+      input = zip_avail_in;
+      rc = zip_codec->code (zip_eof);
+      switch (rc)
+	{
+	case zip_ok:
+	  zip_stream_begun = true;
+	  if (zip_eof && !input && before == zip_avail_out)
+	    FATAL_ERROR ((0, 0, _("%s: Unexpected end of compressed data"),
+			  quotearg_colon (*archive_name_cursor)));
+	  break;
+
+	case zip_stream_end:
+	  zip_streams++;
+	  zip_stream_begun = false;
+	  zip_codec->end ();
+	  zip_codec->init (false);
+	  break;
+
+	case zip_error:
+	  if (! (zip_streams && !zip_stream_begun))
+	    FATAL_ERROR ((0, 0, _("%s: Decompression failed: %s"),
+			  quotearg_colon (*archive_name_cursor), zip_message));
+	  WARN ((0, 0, _("%s: Trailing garbage ignored"),
+		 quotearg_colon (*archive_name_cursor)));
+	  zip_done = true;
+	  break;
+	}
+    }
+  return size - zip_avail_out;
+}
+
+/* Go on decompressing from the start of the stream at OFFSET in the
+   archive.  Return false if the archive cannot be positioned there.  */
+bool
+zip_seek (off_t offset)
+{
+  if (rmtlseek (archive, offset, SEEK_SET) != offset)
+    return false;
+  zip_codec->end ();
+  zip_codec->init (false);
+  zip_avail_in = 0;
+  zip_eof = zip_done = false;
+  zip_streams = 0;
+  zip_stream_begun = false;
+  zip_disowned = false;
+  return true;
+}
+
+/* Leave the current stream to the helper process just forked, which
+   compresses or decompresses the records it writes or reads from now
+   on.  Tar then reads nothing more from the stream, unless it seeks
+   with zip_seek, and does not end the stream on zip_finish.  */
+void
+zip_disown (void)
+{
+  if (!zip_codec)
+    return;
+  zip_done = true;
+  zip_disowned = true;
+}
+
+/* Finish compressing or decompressing the archive, which is about to
+   be closed.  */
+void
+zip_finish (void)
+{
+  if (!zip_codec)
+    return;
+  if (zip_compress && !zip_disowned)
+    {
+      size_t status;
+
+      zip_avail_in = 0;
+      if (! (zip_parallel ? zip_parallel_end (&status)
+	     : zip_deflate (true, &status))
+	  || (zip_fill && !zip_flush (&status)))
+	archive_write_error (status);
+    }
+  if (zip_parallel)
+    zip_parallel_stop ();
+  else
+    zip_codec->end ();
+  zip_parallel = false;
+  zip_codec = NULL;
+  free (zip_buffer);
+  zip_buffer = NULL;
+}
@@ -22,6 +22,18 @@
 #include <system.h>
 
 #include <quotearg.h>
+#include <signal.h>
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#if HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+# include <linux/fiemap.h>
+#endif
 
 #include "common.h"
 #include <hash.h>
@@ -30,12 +42,14 @@
    Pretend the impostor isn't there.  */
 enum { IMPOSTOR_ERRNO = ENOENT };
 
+/* A slot of the table of hard links.  */
 struct link
   {
     dev_t dev;
     ino_t ino;
-    nlink_t nlink;
-    char name[1];
+    nlink_t nlink;		/* Number of links not yet seen */
+    size_t name;		/* Offset of the name in link_names, or zero
+				   if the slot is free */
   };
 
 struct exclusion_tag
@@ -75,14 +89,36 @@ exclusion_tag_warning (const char *dirname, const char *tagname,
 	      message));
 }
 
+/* Return true if NAME is among the ENTRIES of a directory, laid out as
+   by get_directory_entries.  */
+static bool
+directory_has_entry (char const *entries, char const *name)
+{
+  size_t len;
+
+  for (; (len = strlen (entries)) != 0; entries += len + 1)
+    if (strcmp (entries, name) == 0)
+      return true;
+  return false;
+}
+
+/* Return the type of the exclusion tag found in the directory ST, if
+   any, and set *TAG_FILE_NAME to its name.  ENTRIES, if not null, are
+   the entries of the directory: tags not among them are not looked
+   up.  */
 enum exclusion_tag_type
-check_exclusion_tags (struct tar_stat_info const *st, char const **tag_file_name)
+check_exclusion_tags (struct tar_stat_info const *st, char const *entries,
+		      char const **tag_file_name)
 {
   struct exclusion_tag *tag;
 
   for (tag = exclusion_tags; tag; tag = tag->next)
     {
-      int tagfd = subfile_open (st, tag->name, open_read_flags);
+      int tagfd;
+      if (entries && !strchr (tag->name, '/')
+	  && !directory_has_entry (entries, tag->name))
+	continue;
+      tagfd = subfile_open (st, tag->name, open_read_flags);
       if (0 <= tagfd)
 	{
 	  bool satisfied = !tag->predicate || tag->predicate (tagfd);
@@ -131,9 +167,18 @@ cachedir_file_p (int fd)
    digits and a trailing NUL in BUFFER.  */
 #define MAX_OCTAL_VAL(buffer) MAX_VAL_WITH_DIGITS (sizeof (buffer) - 1, LG_8)
 
+/* The two octal digits of each 6-bit value.  */
+static char const octal_digit_pairs[] =
+  "00010203040506071011121314151617"
+  "20212223242526273031323334353637"
+  "40414243444546475051525354555657"
+  "60616263646566677071727374757677";
+
 /* Convert VALUE to an octal representation suitable for tar headers.
    Output to buffer WHERE with size SIZE.
-   The result is undefined if SIZE is 0 or if VALUE is too large to fit.  */
+   The result is undefined if SIZE is 0 or if VALUE is too large to fit.
+   As this is done for every numeric field of every header, the digits
+   are looked up two at a time.  */
 
 static void
 to_octal (uintmax_t value, char *where, size_t size)
@@ -141,12 +186,13 @@ to_octal (uintmax_t value, char *where, size_t size)
   uintmax_t v = value;
   size_t i = size;
 
-  do
+  for (; 2 <= i; i -= 2)
     {
-      where[--i] = '0' + (v & ((1 << LG_8) - 1));
-      v >>= LG_8;
+      memcpy (where + i - 2, octal_digit_pairs + 2 * (v & 077), 2);
+      v >>= 2 * LG_8;
     }
-  while (i);
+  if (i)
+    where[0] = '0' + (v & ((1 << LG_8) - 1));
 }
 
 /* Copy at most LEN bytes from the string SRC to DST.  Terminate with
@@ -448,12 +494,6 @@ uid_to_chars (uid_t v, char *p, size_t s)
   return to_chars (v < 0, (uintmax_t) v, sizeof v, uid_substitute, p, s, "uid_t");
 }
 
-static bool
-uintmax_to_chars (uintmax_t v, char *p, size_t s)
-{
-  return to_chars (0, v, sizeof v, 0, p, s, "uintmax_t");
-}
-
 static void
 string_to_chars (char const *str, char *p, size_t s)
 {
@@ -942,29 +982,23 @@ start_header (struct tar_stat_info *st)
 void
 simple_finish_header (union block *header)
 {
-  size_t i;
-  int sum;
-  char *p;
+  unsigned int sum;
 
   memcpy (header->header.chksum, CHKBLANKS, sizeof header->header.chksum);
 
-  sum = 0;
-  p = header->buffer;
-  for (i = sizeof *header; i-- != 0; )
-    /* We can't use unsigned char here because of old compilers, e.g. V7.  */
-    sum += 0xFF & *p++;
+  sum = block_sum (header, NULL);
 
   /* Fill in the checksum field.  It's formatted differently from the
      other fields: it has [6] digits, a null, then a space -- rather than
-     digits, then a null.  We use to_chars.
-     The final space is already there, from
-     checksumming, and to_chars doesn't modify it.
+     digits, then a null.  The sum of a block always fits in 6 octal
+     digits.  The final space is already there, from checksumming.
 
      This is a fast way to do:
 
      sprintf(header->header.chksum, "%6o", sum);  */
 
-  uintmax_to_chars ((uintmax_t) sum, header->header.chksum, 7);
+  header->header.chksum[6] = '\0';
+  to_octal (sum, header->header.chksum, 6);
 
   set_next_block_after (header);
 }
@@ -1008,11 +1042,663 @@ pad_archive (off_t size_left)
     }
 }
 
+/* Metadata and contents prefetch.
+
+   On file systems where each request has a high latency, such as NFS,
+   archiving many small files is dominated by the round trips needed to
+   stat, open and read them one at a time.  With --prefetch, tar forks
+   a pool of helper processes the first time it dumps a large enough
+   directory, and keeps them until the archive is written.  As dump_dir0
+   goes through a directory, it hands the entries ahead of it to the
+   helpers in turn, over sockets that also pass them the descriptor of
+   the directory, so that several requests are in progress at a time.
+   The helpers stat the entries and open the files to be dumped.
+
+   With --prefetch-size, the helpers also read the files into a pool of
+   memory shared with tar, of the given size.  Each helper fills its
+   own part of the pool as a ring, and tells tar through a pipe about
+   every file it has read, with the status the file had then.  When
+   tar comes to that file and finds it unchanged, dump_regular_file
+   copies its contents from the pool instead of reading the file.  Tar
+   hands the space back to a helper once it is done with the files
+   before it in the ring.  Files that do not fit in the free part of a
+   ring are only read ahead by the system, as without --prefetch-size.
+
+   Tar never waits for the helpers: a file they have not read yet is
+   read by tar itself.  The archive is thus the same as without
+   prefetching.
+
+   When dump_dir0 starts on a subdirectory, it stops handing out the
+   entries of the enclosing directory, and goes on from where it left
+   off once the subdirectory is done.  The files of the enclosing
+   directory already read stay in the pool meanwhile.  */
+
+#if (HAVE_SYS_SOCKET_H && defined SOCK_SEQPACKET && defined SCM_RIGHTS \
+     && defined CMSG_SPACE)
+# define PREFETCH_SUPPORTED 1
+#else
+# define PREFETCH_SUPPORTED 0
+#endif
+
+/* Do not get SIGPIPE if a helper has died.  */
+#ifdef MSG_NOSIGNAL
+# define PREFETCH_SEND_FLAGS MSG_NOSIGNAL
+#else
+# define PREFETCH_SEND_FLAGS 0
+#endif
+
+/* Directories with fewer entries are not worth prefetching.  */
+enum { PREFETCH_MIN_ENTRIES = 16 };
+
+/* Number of entries handed to each helper ahead of the entry being
+   dumped.  */
+enum { PREFETCH_AHEAD = 16 };
+
+/* Longest entry name handed to the helpers.  */
+enum { PREFETCH_NAME_MAX = 4096 };
+
+/* A request from tar to a helper, followed by the name of an entry.
+   It comes with a descriptor of the directory of the entry when the
+   previous request was for another directory.  */
+struct prefetch_request
+{
+  size_t serial;                /* Serial number of the directory, or 0
+				   if the request only hands back space */
+  size_t index;                 /* Index of the entry in the directory */
+  size_t released;              /* Ring position freed by tar */
+};
+
+/* A file read into the pool by a helper.  */
+struct prefetched
+{
+  size_t helper;                /* The helper */
+  size_t serial;                /* Serial number of its directory */
+  size_t index;                 /* Index of the entry in the directory */
+  size_t end;                   /* Position in the helper's ring just
+				   after the contents */
+  size_t size;                  /* Size of the contents */
+  dev_t dev;                    /* Status of the file after reading it */
+  ino_t ino;
+  struct timespec mtime;
+  struct timespec ctime;
+  bool done;                    /* True once tar is done with the file */
+  struct prefetched *next;      /* Next file in the helper's ring */
+};
+
+/* A helper process.  */
+struct prefetch_helper
+{
+  pid_t pid;
+  int fd;                       /* Socket for the requests */
+  size_t serial;                /* Directory of the last request sent */
+  size_t released;              /* Ring position freed by tar */
+  size_t sent;                  /* Ring position last handed back */
+  struct prefetched *head;      /* Files read, in ring order */
+  struct prefetched *tail;
+};
+
+/* Prefetching for a directory.  */
+struct prefetch
+{
+  struct tar_stat_info const *dir; /* The directory */
+  unsigned char const *types;   /* The types of its entries */
+  char const *next_entry;       /* Next entry to hand out */
+  size_t next_index;            /* Its index */
+  size_t current;               /* Index of the entry being dumped */
+  size_t serial;                /* Serial number, or 0 if the directory
+				   is not prefetched */
+  char *name_buf;               /* Full names of the entries */
+  size_t name_len;              /* Length of the directory name in it */
+  size_t name_size;             /* Size allocated for it, minus 1 */
+  struct prefetch *outer;       /* Prefetching of the enclosing
+				   directory */
+};
+
+/* Prefetching of the directory being dumped.  */
+static struct prefetch *prefetch_current;
+
+/* Last serial number given to a directory.  */
+static size_t prefetch_serial;
+
+/* The helpers, and the next one to hand an entry to.  */
+static struct prefetch_helper *prefetch_helpers;
+static size_t prefetch_helper_count;
+static size_t prefetch_next_helper;
+
+/* Pipe for the files read by the helpers.  */
+static int prefetch_reply_fd;
+
+/* The prefetched contents of the file being dumped, if any.  */
+static struct prefetched *prefetch_hit;
+
+/* The shared pool, and the size of the part of each helper.  */
+static char *prefetch_pool;
+static size_t prefetch_arena_size;
+
+/* Allocate the shared pool, if contents are to be prefetched.  */
+static void
+prefetch_pool_init (void)
+{
+#if HAVE_SYS_MMAN_H && defined MAP_SHARED && defined MAP_ANONYMOUS
+  void *ptr;
+
+  /* Reading the files ahead would change their access time before tar
+     records it.  */
+  if (!prefetch_size_option
+      || atime_preserve_option == replace_atime_preserve)
+    return;
+
+  prefetch_arena_size = prefetch_size_option / prefetch_option;
+  if (prefetch_arena_size < BLOCKSIZE)
+    return;
+  ptr = mmap (NULL, prefetch_arena_size * prefetch_option,
+	      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED)
+    WARN ((0, errno, _("Cannot allocate the prefetch pool")));
+  else
+    prefetch_pool = ptr;
+#endif
+}
+
+#if PREFETCH_SUPPORTED
+/* Receive into BUF of size SIZE a request from FD, and the descriptor
+   that comes with it into *DIRFD, or -1 if none.  Return the size of
+   the request, 0 if tar has closed the socket, or -1 on error.  */
+static ssize_t
+prefetch_recv (int fd, char *buf, size_t size, int *dirfd)
+{
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *c;
+  ssize_t n;
+
+  iov.iov_base = buf;
+  iov.iov_len = size;
+  memset (&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+
+  while ((n = recvmsg (fd, &msg, 0)) < 0 && errno == EINTR)
+    continue;
+
+  *dirfd = -1;
+  if (0 < n)
+    for (c = CMSG_FIRSTHDR (&msg); c; c = CMSG_NXTHDR (&msg, c))
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+	memcpy (dirfd, CMSG_DATA (c), sizeof *dirfd);
+  return n;
+}
+
+/* Send to helper H the request REQ for the entry NAME, or for no entry
+   if NAME is null, together with the descriptor DIRFD if it is not
+   negative.  Return true if the request was sent.  */
+static bool
+prefetch_send (struct prefetch_helper const *h,
+	       struct prefetch_request const *req,
+	       char const *name, int dirfd)
+{
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct iovec iov[2];
+  struct msghdr msg;
+  size_t size = sizeof *req + (name ? strlen (name) : 0);
+
+  iov[0].iov_base = (void *) req;
+  iov[0].iov_len = sizeof *req;
+  iov[1].iov_base = (void *) name;
+  iov[1].iov_len = size - sizeof *req;
+  memset (&msg, 0, sizeof msg);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  if (0 <= dirfd)
+    {
+      struct cmsghdr *c;
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof control.buf;
+      c = CMSG_FIRSTHDR (&msg);
+      c->cmsg_level = SOL_SOCKET;
+      c->cmsg_type = SCM_RIGHTS;
+      c->cmsg_len = CMSG_LEN (sizeof dirfd);
+      memcpy (CMSG_DATA (c), &dirfd, sizeof dirfd);
+    }
+  return sendmsg (h->fd, &msg, PREFETCH_SEND_FLAGS) == size;
+}
+
+/* Main function of helper K, serving the requests from FD and
+   reporting the files read on REPLY_FD.  */
+static void prefetch_run (size_t k, int fd, int reply_fd)
+  __attribute__ ((noreturn));
+
+static void
+prefetch_run (size_t k, int fd, int reply_fd)
+{
+  char *arena = prefetch_pool ? prefetch_pool + k * prefetch_arena_size : NULL;
+  size_t head = 0;
+  size_t tail = 0;
+  int dirfd = -1;
+  char buf[sizeof (struct prefetch_request) + PREFETCH_NAME_MAX + 1];
+  ssize_t n;
+  int newfd;
+
+  while (0 < (n = prefetch_recv (fd, buf, sizeof buf - 1, &newfd)))
+    {
+      struct prefetch_request req;
+      char const *name = buf + sizeof req;
+      struct stat st;
+      int file;
+
+      if (0 <= newfd)
+	{
+	  if (0 <= dirfd)
+	    close (dirfd);
+	  dirfd = newfd;
+	}
+      if (n < sizeof req)
+	continue;
+      memcpy (&req, buf, sizeof req);
+      buf[n] = 0;
+      if (tail < req.released)
+	tail = req.released;
+      if (!req.serial || dirfd < 0)
+	continue;
+
+      if (! (stat_at (dirfd, name, &st, fstatat_flags,
+		      STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_BLOCKS) == 0
+	     && !S_ISDIR (st.st_mode) && file_dumpable_p (&st)))
+	continue;
+      file = openat (dirfd, name, open_read_flags | O_NONBLOCK);
+      if (file < 0)
+	continue;
+
+      if (arena && 0 < st.st_size && st.st_size <= prefetch_arena_size)
+	{
+	  struct prefetched p;
+	  size_t start = head;
+
+	  /* Keep the contents contiguous.  */
+	  if (prefetch_arena_size - start % prefetch_arena_size < st.st_size)
+	    start += prefetch_arena_size - start % prefetch_arena_size;
+	  p.helper = k;
+	  p.serial = req.serial;
+	  p.index = req.index;
+	  p.size = st.st_size;
+	  p.end = start + p.size;
+
+	  /* Do not wait for tar to hand back space: it may be busy
+	     elsewhere.  Leave the file to the system instead.  */
+	  if (p.end <= tail + prefetch_arena_size
+	      && safe_read (file, arena + start % prefetch_arena_size, p.size)
+		 == p.size
+	      && stat_fd (file, &st, (STATX_INO | STATX_SIZE
+				      | STATX_MTIME | STATX_CTIME)) == 0
+	      && st.st_size == p.size)
+	    {
+	      p.dev = st.st_dev;
+	      p.ino = st.st_ino;
+	      p.mtime = get_stat_mtime (&st);
+	      p.ctime = get_stat_ctime (&st);
+	      p.done = false;
+	      p.next = NULL;
+	      if (full_write (reply_fd, &p, sizeof p) != sizeof p)
+		break;
+	      head = p.end;
+	    }
+	  else
+	    advise_sequential_read (file, 0, -1);
+	}
+      else
+	advise_sequential_read (file, 0, -1);
+      close (file);
+    }
+  _exit (0);
+}
+#endif
+
+/* Start the pool of helpers, unless this was already attempted.  */
+static void
+prefetch_pool_start (void)
+{
+#if PREFETCH_SUPPORTED
+  static bool started;
+  int reply_pipe[2];
+  size_t k;
+
+  if (started)
+    return;
+  started = true;
+
+  prefetch_pool_init ();
+  if (pipe (reply_pipe) != 0)
+    return;
+  prefetch_helpers = xcalloc (prefetch_option, sizeof *prefetch_helpers);
+  for (k = 0; k < prefetch_option; k++)
+    {
+      struct prefetch_helper *h = &prefetch_helpers[k];
+      int sv[2];
+
+      /* Prefetching is only an optimization, so give up quietly when
+	 out of processes or descriptors.  */
+      if (socketpair (AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0)
+	break;
+      h->pid = fork ();
+      if (h->pid < 0)
+	{
+	  close (sv[0]);
+	  close (sv[1]);
+	  break;
+	}
+      if (h->pid == 0)
+	{
+	  size_t j;
+	  for (j = 0; j < k; j++)
+	    close (prefetch_helpers[j].fd);
+	  close (sv[0]);
+	  close (reply_pipe[0]);
+	  close_archive_descriptors ();
+	  prefetch_run (k, sv[1], reply_pipe[1]);
+	}
+      close (sv[1]);
+      h->fd = sv[0];
+      fcntl (h->fd, F_SETFL, O_NONBLOCK);
+      fcntl (h->fd, F_SETFD, FD_CLOEXEC);
+    }
+  close (reply_pipe[1]);
+  prefetch_helper_count = k;
+  if (!k)
+    {
+      close (reply_pipe[0]);
+      return;
+    }
+  prefetch_reply_fd = reply_pipe[0];
+  fcntl (prefetch_reply_fd, F_SETFL, O_NONBLOCK);
+  fcntl (prefetch_reply_fd, F_SETFD, FD_CLOEXEC);
+#endif
+}
+
+/* Stop the pool of helpers, if running.  */
+static void
+prefetch_pool_stop (void)
+{
+  size_t k;
+
+  if (!prefetch_helper_count)
+    return;
+  /* The helpers exit once their sockets are closed.  Closing the pipe
+     too gets those blocked on it out of the way.  */
+  for (k = 0; k < prefetch_helper_count; k++)
+    close (prefetch_helpers[k].fd);
+  close (prefetch_reply_fd);
+  for (k = 0; k < prefetch_helper_count; k++)
+    {
+      struct prefetch_helper *h = &prefetch_helpers[k];
+      struct prefetched *p, *next;
+
+      while (waitpid (h->pid, NULL, 0) < 0 && errno == EINTR)
+	continue;
+      for (p = h->head; p; p = next)
+	{
+	  next = p->next;
+	  free (p);
+	}
+    }
+  free (prefetch_helpers);
+  prefetch_helpers = NULL;
+  prefetch_helper_count = 0;
+}
+
+/* Return the prefetching of the directory of serial number SERIAL, if
+   it is being dumped.  */
+static struct prefetch const *
+prefetch_find (size_t serial)
+{
+  struct prefetch const *pf;
+
+  for (pf = prefetch_current; pf; pf = pf->outer)
+    if (pf->serial == serial)
+      return pf;
+  return NULL;
+}
+
+/* Collect the files read by the helpers so far.  Those tar is already
+   done with are only kept until their space can be handed back.  */
+static void
+prefetch_receive (void)
+{
+  struct prefetched buf[32];
+  ssize_t n;
+
+  while ((n = read (prefetch_reply_fd, buf, sizeof buf)) > 0)
+    {
+      size_t i;
+      for (i = 0; i < n / sizeof *buf; i++)
+	{
+	  struct prefetch_helper *h = &prefetch_helpers[buf[i].helper];
+	  struct prefetch const *pf = prefetch_find (buf[i].serial);
+	  struct prefetched *p = xmalloc (sizeof *p);
+	  *p = buf[i];
+	  p->done = !pf || p->index < pf->current;
+	  p->next = NULL;
+	  if (h->tail)
+	    h->tail->next = p;
+	  else
+	    h->head = p;
+	  h->tail = p;
+	}
+    }
+}
+
+/* Mark as done the files of the directory of PF before entry INDEX,
+   and the file at INDEX too if INCLUSIVE.  */
+static void
+prefetch_done (struct prefetch const *pf, size_t index, bool inclusive)
+{
+  size_t k;
+
+  for (k = 0; k < prefetch_helper_count; k++)
+    {
+      struct prefetched *p;
+      for (p = prefetch_helpers[k].head; p; p = p->next)
+	if (p->serial == pf->serial
+	    && (p->index < index || (inclusive && p->index == index)))
+	  p->done = true;
+    }
+}
+
+/* Hand back to the helpers the space at the start of their rings that
+   tar is done with.  */
+static void
+prefetch_release (void)
+{
+#if PREFETCH_SUPPORTED
+  size_t k;
+
+  for (k = 0; k < prefetch_helper_count; k++)
+    {
+      struct prefetch_helper *h = &prefetch_helpers[k];
+
+      while (h->head && h->head->done)
+	{
+	  struct prefetched *p = h->head;
+	  h->head = p->next;
+	  if (!h->head)
+	    h->tail = NULL;
+	  h->released = p->end;
+	  free (p);
+	}
+      if (h->sent != h->released)
+	{
+	  struct prefetch_request req;
+	  req.serial = 0;
+	  req.index = 0;
+	  req.released = h->released;
+	  if (prefetch_send (h, &req, NULL, -1))
+	    h->sent = h->released;
+	}
+    }
+#endif
+}
+
+/* Hand out to the helpers the entries of the directory of PF up to
+   entry LIMIT, excluded.  Stop early if the helpers are busy.  */
+static void
+prefetch_dispatch (struct prefetch *pf, size_t limit)
+{
+#if PREFETCH_SUPPORTED
+  while (pf->next_index < limit && *pf->next_entry)
+    {
+      char const *entry = pf->next_entry;
+      size_t entry_len = strlen (entry);
+      unsigned char type = pf->types[pf->next_index];
+
+      if (pf->name_size < pf->name_len + entry_len)
+	{
+	  pf->name_size = pf->name_len + entry_len;
+	  pf->name_buf = xrealloc (pf->name_buf, pf->name_size + 1);
+	}
+      strcpy (pf->name_buf + pf->name_len, entry);
+
+      /* Only regular files that are going to be dumped are worth
+	 opening.  */
+      if (pf->current <= pf->next_index && entry_len <= PREFETCH_NAME_MAX
+	  && (type == DT_UNKNOWN || type == DT_REG
+	      || (type == DT_LNK && dereference_option))
+	  && !excluded_name (pf->name_buf))
+	{
+	  struct prefetch_helper *h = &prefetch_helpers[prefetch_next_helper];
+	  struct prefetch_request req;
+
+	  if (h->serial != pf->serial && pf->dir->fd <= 0)
+	    return;
+	  req.serial = pf->serial;
+	  req.index = pf->next_index;
+	  req.released = h->released;
+	  if (!prefetch_send (h, &req, entry,
+			      h->serial == pf->serial ? -1 : pf->dir->fd))
+	    return;
+	  h->serial = pf->serial;
+	  h->sent = h->released;
+	  prefetch_next_helper = (prefetch_next_helper + 1)
+				 % prefetch_helper_count;
+	}
+      pf->next_entry = entry + entry_len + 1;
+      pf->next_index++;
+    }
+#endif
+}
+
+/* Prepare prefetching for the directory ST with entries DIRECTORY of
+   types TYPES.  */
+static void
+prefetch_init (struct prefetch *pf, struct tar_stat_info const *st,
+	       char const *directory, unsigned char const *types)
+{
+  char const *entry;
+  size_t entries = 0;
+
+  memset (pf, 0, sizeof *pf);
+  if (!prefetch_option || st->fd <= 0)
+    return;
+  for (entry = directory; *entry; entry += strlen (entry) + 1)
+    if (++entries == PREFETCH_MIN_ENTRIES)
+      break;
+  if (entries < PREFETCH_MIN_ENTRIES)
+    return;
+
+  prefetch_pool_start ();
+  if (!prefetch_helper_count)
+    return;
+  pf->dir = st;
+  pf->types = types;
+  pf->next_entry = directory;
+  pf->serial = ++prefetch_serial;
+  pf->name_buf = xstrdup (st->orig_file_name);
+  pf->name_size = pf->name_len = strlen (pf->name_buf);
+
+  /* The enclosing directory gets its turn again when it resumes.  */
+  pf->outer = prefetch_current;
+  prefetch_current = pf;
+}
+
+/* Get ready to dump entry INDEX of the directory of PF.  */
+static void
+prefetch_entry (struct prefetch *pf, size_t index)
+{
+  struct prefetched *p;
+  size_t k;
+
+  if (!pf->serial)
+    return;
+  pf->current = index;
+  prefetch_receive ();
+  prefetch_done (pf, index, false);
+  prefetch_release ();
+  prefetch_hit = NULL;
+  for (k = 0; k < prefetch_helper_count && !prefetch_hit; k++)
+    for (p = prefetch_helpers[k].head; p; p = p->next)
+      if (p->serial == pf->serial && p->index == index)
+	{
+	  prefetch_hit = p;
+	  break;
+	}
+  prefetch_dispatch (pf, index + 1 + PREFETCH_AHEAD * prefetch_helper_count);
+}
+
+/* Done with entry INDEX of the directory of PF.  */
+static void
+prefetch_entry_done (struct prefetch *pf, size_t index)
+{
+  prefetch_hit = NULL;
+  if (pf->serial)
+    prefetch_done (pf, index, true);
+}
+
+/* Done with the directory of PF.  */
+static void
+prefetch_finish (struct prefetch *pf)
+{
+  if (!pf->serial)
+    return;
+  prefetch_done (pf, SIZE_MAX, true);
+  prefetch_release ();
+  free (pf->name_buf);
+  prefetch_current = pf->outer;
+}
+
+/* Return the prefetched contents of the file ST, if they are still
+   current, or NULL.  */
+static char const *
+prefetch_data (struct tar_stat_info const *st)
+{
+  struct prefetched const *p = prefetch_hit;
+
+  if (! (p && p->size == st->stat.st_size
+	 && p->dev == st->stat.st_dev && p->ino == st->stat.st_ino
+	 && timespec_cmp (p->mtime, get_stat_mtime (&st->stat)) == 0
+	 && timespec_cmp (p->ctime, get_stat_ctime (&st->stat)) == 0))
+    return NULL;
+  return (prefetch_pool + p->helper * prefetch_arena_size
+	  + (p->end - p->size) % prefetch_arena_size);
+}
+
 static enum dump_status
 dump_regular_file (int fd, struct tar_stat_info *st)
 {
   off_t size_left = st->stat.st_size;
   off_t block_ordinal;
+  off_t advised = -1;
+  char const *data = fd > 0 ? prefetch_data (st) : NULL;
+  bool copy = fd > 0 && !data;
+  struct uring_stream *reader = NULL;
   union block *blk;
 
   block_ordinal = current_block_ordinal ();
@@ -1035,6 +1721,19 @@ dump_regular_file (int fd, struct tar_stat_info *st)
 
       bufsize = available_space_after (blk);
 
+      /* Once the buffer is empty, let the system copy the whole
+	 records.  */
+      if (copy && bufsize == record_size)
+	{
+	  off_t copied = copy_to_archive (fd, st->orig_file_name, size_left);
+	  copy = false;
+	  if (copied)
+	    {
+	      size_left -= copied;
+	      continue;
+	    }
+	}
+
       if (size_left < bufsize)
 	{
 	  /* Last read -- zero out area beyond.  */
@@ -1044,11 +1743,33 @@ dump_regular_file (int fd, struct tar_stat_info *st)
 	    memset (blk->buffer + size_left, 0, BLOCKSIZE - count);
 	}
 
-      count = (fd <= 0) ? bufsize : safe_read (fd, blk->buffer, bufsize);
+      if (data)
+	{
+	  memcpy (blk->buffer, data + st->stat.st_size - size_left, bufsize);
+	  count = bufsize;
+	}
+      else
+	{
+	  if (fd > 0 && !reader && io_uring_option)
+	    reader = uring_open_read (fd, st->stat.st_size - size_left,
+				      size_left, URING_CHUNK);
+	  if (reader)
+	    count = uring_read (reader, blk->buffer, bufsize);
+	  else
+	    {
+	      if (fd > 0)
+		advised = advise_sequential_read (fd,
+						  st->stat.st_size - size_left,
+						  advised);
+	      count = (fd <= 0) ? bufsize
+		                : safe_read (fd, blk->buffer, bufsize);
+	    }
+	}
       if (count == SAFE_READ_ERROR)
 	{
 	  read_diag_details (st->orig_file_name,
 	                     st->stat.st_size - size_left, bufsize);
+	  uring_close (reader);
 	  pad_archive (size_left);
 	  return dump_status_short;
 	}
@@ -1068,19 +1789,23 @@ dump_regular_file (int fd, struct tar_stat_info *st)
 		    STRINGIFY_BIGINT (size_left, buf)));
 	  if (! ignore_failed_read_option)
 	    set_exit_status (TAREXIT_DIFFERS);
+	  uring_close (reader);
 	  pad_archive (size_left - (bufsize - count));
 	  return dump_status_short;
 	}
     }
+  uring_close (reader);
   return dump_status_ok;
 }
 
 
 /* Copy info from the directory identified by ST into the archive.
-   DIRECTORY contains the directory's entries.  */
+   DIRECTORY contains the directory's entries and TYPES their types,
+   unless --no-recursion.  */
 
 static void
-dump_dir0 (struct tar_stat_info *st, char const *directory)
+dump_dir0 (struct tar_stat_info *st, char const *directory,
+	   unsigned char const *types)
 {
   bool top_level = ! st->parent;
   const char *tag_file_name;
@@ -1165,7 +1890,7 @@ dump_dir0 (struct tar_stat_info *st, char const *directory)
       char *name_buf;
       size_t name_size;
 
-      switch (check_exclusion_tags (st, &tag_file_name))
+      switch (check_exclusion_tags (st, directory, &tag_file_name))
 	{
 	case exclusion_tag_all:
 	  /* Handled in dump_file0 */
@@ -1176,13 +1901,18 @@ dump_dir0 (struct tar_stat_info *st, char const *directory)
 	    char const *entry;
 	    size_t entry_len;
 	    size_t name_len;
+	    size_t index;
+	    struct prefetch prefetch;
+
+	    prefetch_init (&prefetch, st, directory, types);
 
 	    name_buf = xstrdup (st->orig_file_name);
 	    name_size = name_len = strlen (name_buf);
 
 	    /* Now output all the files in the directory.  */
-	    for (entry = directory; (entry_len = strlen (entry)) != 0;
-		 entry += entry_len + 1)
+	    for (entry = directory, index = 0;
+		 (entry_len = strlen (entry)) != 0;
+		 entry += entry_len + 1, index++)
 	      {
 		if (name_size < name_len + entry_len)
 		  {
@@ -1191,9 +1921,14 @@ dump_dir0 (struct tar_stat_info *st, char const *directory)
 		  }
 		strcpy (name_buf + name_len, entry);
 		if (!excluded_name (name_buf))
-		  dump_file (st, entry, name_buf);
+		  {
+		    prefetch_entry (&prefetch, index);
+		    dump_file (st, entry, name_buf);
+		    prefetch_entry_done (&prefetch, index);
+		  }
 	      }
 
+	    prefetch_finish (&prefetch);
 	    free (name_buf);
 	  }
 	  break;
@@ -1259,36 +1994,189 @@ open_failure_recover (struct tar_stat_info const *dir)
   return false;
 }
 
+/* Directory sorting.
+
+   By default the entries of a directory are archived in the order the
+   system returns them, which on many file systems is the order of a
+   hash of their names.  --sort=name gives an order that does not
+   depend on the file system, for reproducible archives.  --sort=inode
+   and --sort=extent approximate the order of the files on the disk,
+   which avoids seeks when reading from rotating media.  */
+
+/* An entry of the directory being sorted.  */
+struct sort_entry
+{
+  size_t offset;                /* Offset of its name */
+  ino_t ino;                    /* Its inode number */
+  uintmax_t pos;                /* Physical position of its data */
+  unsigned char type;           /* Its type, as DT_* */
+};
+
+/* The names of the entries being sorted.  */
+static char const *sort_names;
+
+static int
+compare_sort_names (void const *a, void const *b)
+{
+  struct sort_entry const *p = a;
+  struct sort_entry const *q = b;
+  return strcmp (sort_names + p->offset, sort_names + q->offset);
+}
+
+static int
+compare_sort_positions (void const *a, void const *b)
+{
+  struct sort_entry const *p = a;
+  struct sort_entry const *q = b;
+  if (p->pos != q->pos)
+    return p->pos < q->pos ? -1 : 1;
+  return p->ino < q->ino ? -1 : p->ino > q->ino;
+}
+
+/* Return the physical position of the start of the file of the entry
+   DP in the directory DIRFD, or 0 if it is not a regular file, has no
+   data or the position is unknown.  */
+static uintmax_t
+first_extent (int dirfd, struct dirent const *dp)
+{
+#ifdef FS_IOC_FIEMAP
+  union
+  {
+    struct fiemap map;
+    char buf[sizeof (struct fiemap) + sizeof (struct fiemap_extent)];
+  } u;
+  struct stat st;
+  int fd;
+  uintmax_t pos = 0;
+
+  if (dp->d_type != DT_REG
+      && ! (dp->d_type == DT_UNKNOWN
+	    && stat_at (dirfd, dp->d_name, &st, fstatat_flags, STATX_TYPE) == 0
+	    && S_ISREG (st.st_mode)))
+    return 0;
+  fd = openat (dirfd, dp->d_name, open_read_flags | O_NONBLOCK);
+  if (fd < 0)
+    return 0;
+  memset (&u, 0, sizeof u);
+  u.map.fm_length = FIEMAP_MAX_OFFSET;
+  u.map.fm_extent_count = 1;
+  if (ioctl (fd, FS_IOC_FIEMAP, &u.map) == 0 && u.map.fm_mapped_extents)
+    pos = u.map.fm_extents[0].fe_physical;
+  close (fd);
+  return pos;
+#else
+  return 0;
+#endif
+}
+
+/* Read the entries of the directory ST and return them as
+   streamsavedir does, in the order requested by --sort.  Set *TYPES to
+   their types, as for get_directory_entries.  */
+static char *
+read_directory_entries (struct tar_stat_info *st, unsigned char **types)
+{
+  char *names = NULL;
+  size_t names_size = 0;
+  size_t used = 0;
+  struct sort_entry *entries = NULL;
+  size_t entries_size = 0;
+  size_t count = 0;
+  size_t i;
+  char *result;
+  char *p;
+
+  for (;;)
+    {
+      struct dirent const *dp;
+      char const *entry;
+      size_t entry_size;
+
+      errno = 0;
+      dp = readdir (st->dirstream);
+      if (! dp)
+	break;
+      entry = dp->d_name;
+      if (entry[entry[0] != '.' ? 0 : entry[1] != '.' ? 1 : 2] == '\0')
+	continue;
+
+      entry_size = strlen (entry) + 1;
+      while (names_size < used + entry_size)
+	names = x2nrealloc (names, &names_size, 1);
+      memcpy (names + used, entry, entry_size);
+
+      if (count == entries_size)
+	entries = x2nrealloc (entries, &entries_size, sizeof *entries);
+      entries[count].offset = used;
+#if D_INO_IN_DIRENT
+      entries[count].ino = dp->d_ino;
+#else
+      entries[count].ino = 0;
+#endif
+      entries[count].pos = (sort_option == extent_sort
+			    ? first_extent (st->fd, dp) : 0);
+      entries[count].type = DIRENT_TYPE (dp);
+      count++;
+      used += entry_size;
+    }
+
+  if (errno)
+    {
+      int e = errno;
+      free (names);
+      free (entries);
+      errno = e;
+      return NULL;
+    }
+
+  if (sort_option != no_sort)
+    {
+      sort_names = names;
+      qsort (entries, count, sizeof *entries,
+	     sort_option == name_sort
+	     ? compare_sort_names : compare_sort_positions);
+    }
+
+  p = result = xmalloc (used + 1);
+  *types = xmalloc (count + 1);
+  for (i = 0; i < count; i++)
+    {
+      size_t entry_size = strlen (names + entries[i].offset) + 1;
+      memcpy (p, names + entries[i].offset, entry_size);
+      p += entry_size;
+      (*types)[i] = entries[i].type;
+    }
+  *p = '\0';
+  free (names);
+  free (entries);
+  return result;
+}
+
 /* Return the directory entries of ST, in a dynamically allocated buffer,
    each entry followed by '\0' and the last followed by an extra '\0'.
+   Set *TYPES to a dynamically allocated array of their types, as DT_*
+   values, which are DT_UNKNOWN where the system does not tell.
    Return null on failure, setting errno.  */
 char *
-get_directory_entries (struct tar_stat_info *st)
+get_directory_entries (struct tar_stat_info *st, unsigned char **types)
 {
   while (! (st->dirstream = fdopendir (st->fd)))
     if (! open_failure_recover (st))
       return 0;
-  return streamsavedir (st->dirstream);
+  return read_directory_entries (st, types);
 }
 
-/* Dump the directory ST.  Return true if successful, false (emitting
-   diagnostics) otherwise.  Get ST's entries, recurse through its
-   subdirectories, and clean up file descriptors afterwards.  */
-static bool
-dump_dir (struct tar_stat_info *st)
+/* Dump the directory ST, whose entries are DIRECTORY and their types
+   TYPES, as read by get_directory_entries unless --no-recursion.
+   Recurse through its subdirectories, and clean up file descriptors
+   afterwards.  */
+static void
+dump_dir (struct tar_stat_info *st, char *directory, unsigned char *types)
 {
-  char *directory = get_directory_entries (st);
-  if (! directory)
-    {
-      savedir_diag (st->orig_file_name);
-      return false;
-    }
-
-  dump_dir0 (st, directory);
+  dump_dir0 (st, directory, types);
 
   restore_parent_fd (st);
   free (directory);
-  return true;
+  free (types);
 }
 
 
@@ -1385,6 +2273,7 @@ create_archive (void)
 	  dump_file (0, name, name);
     }
 
+  prefetch_pool_stop ();
   write_eot ();
   close_archive ();
   finish_deferred_unlinks ();
@@ -1393,24 +2282,6 @@ create_archive (void)
 }
 
 
-/* Calculate the hash of a link.  */
-static size_t
-hash_link (void const *entry, size_t n_buckets)
-{
-  struct link const *l = entry;
-  uintmax_t num = l->dev ^ l->ino;
-  return num % n_buckets;
-}
-
-/* Compare two links for equality.  */
-static bool
-compare_links (void const *entry1, void const *entry2)
-{
-  struct link const *link1 = entry1;
-  struct link const *link2 = entry2;
-  return ((link1->dev ^ link2->dev) | (link1->ino ^ link2->ino)) == 0;
-}
-
 static void
 unknown_file_error (char const *p)
 {
@@ -1426,8 +2297,214 @@ unknown_file_error (char const *p)
 
 /* Table of all non-directories that we've written so far.  Any time
    we see another, we check the table and avoid dumping the data
-   again if we've done it once already.  */
-static Hash_table *link_table;
+   again if we've done it once already.
+
+   Archiving trees with millions of hard links makes the table large,
+   so it is kept compact: it is an open addressing table with linear
+   probing of LINK_SLOTS slots (a power of two), which holds the keys
+   inline, and the names are stored one after the other in the
+   LINK_NAMES arena.  An entry is removed as soon as all the links to
+   its file have been seen, unless the same file may be named several
+   times.  The arena is compacted when most of it is taken by the names
+   of removed entries.  */
+static struct link *link_table;
+static size_t link_slots;
+static size_t link_count;
+static char *link_names;
+static size_t link_names_used;
+static size_t link_names_alloc;
+static size_t link_names_free;
+static size_t link_memory_peak;
+
+/* Return the index of the home slot of the file DEV and INO.  */
+static size_t
+link_hash (dev_t dev, ino_t ino)
+{
+  uint64_t d = dev;
+  uint64_t h = (ino ^ (d << 32 | d >> 32)) * 0x9E3779B97F4A7C15ULL;
+  return (h ^ h >> 32) & (link_slots - 1);
+}
+
+/* Return the slot of the file DEV and INO, or null if it is not in
+   the table.  */
+static struct link *
+link_lookup (dev_t dev, ino_t ino)
+{
+  size_t i;
+
+  if (!link_count)
+    return NULL;
+  for (i = link_hash (dev, ino); link_table[i].name;
+       i = (i + 1) & (link_slots - 1))
+    if (link_table[i].ino == ino && link_table[i].dev == dev)
+      return &link_table[i];
+  return NULL;
+}
+
+/* Return the free slot where to insert the file DEV and INO, which is
+   not in the table.  */
+static struct link *
+link_free_slot (dev_t dev, ino_t ino)
+{
+  size_t i;
+  for (i = link_hash (dev, ino); link_table[i].name;
+       i = (i + 1) & (link_slots - 1))
+    continue;
+  return &link_table[i];
+}
+
+/* Update the peak memory use of the table.  */
+static void
+link_memory_update (void)
+{
+  size_t memory = link_slots * sizeof *link_table + link_names_alloc;
+  if (link_memory_peak < memory)
+    link_memory_peak = memory;
+}
+
+/* Return the largest amount of memory used by the table of hard
+   links.  */
+size_t
+link_table_memory (void)
+{
+  return link_memory_peak;
+}
+
+/* Make room for one more entry in the table.  */
+static void
+link_table_grow (void)
+{
+  struct link *old = link_table;
+  size_t old_slots = link_slots;
+  size_t i;
+
+  /* Keep the load factor below 3/4.  */
+  if (link_count + 1 <= link_slots / 4 * 3)
+    return;
+
+  link_slots = old_slots ? old_slots * 2 : 1024;
+  if (link_slots <= old_slots)
+    xalloc_die ();
+  link_table = xcalloc (link_slots, sizeof *link_table);
+  for (i = 0; i < old_slots; i++)
+    if (old[i].name)
+      *link_free_slot (old[i].dev, old[i].ino) = old[i];
+  free (old);
+  link_memory_update ();
+}
+
+/* Copy the names of the entries into a new arena, dropping those of
+   the removed entries.  */
+static void
+link_names_compact (void)
+{
+  size_t alloc = link_names_used - link_names_free;
+  char *names;
+  size_t used = 1;
+  size_t i;
+
+  alloc += alloc / 2 + 1;
+  names = xmalloc (alloc);
+  names[0] = '\0';
+  for (i = 0; i < link_slots; i++)
+    if (link_table[i].name)
+      {
+	char const *name = link_names + link_table[i].name;
+	size_t size = strlen (name) + 1;
+	memcpy (names + used, name, size);
+	link_table[i].name = used;
+	used += size;
+      }
+  free (link_names);
+  link_names = names;
+  link_names_used = used;
+  link_names_alloc = alloc;
+  link_names_free = 0;
+}
+
+/* Store NAME into the arena, and return its offset.  */
+static size_t
+link_names_add (char const *name)
+{
+  size_t size = strlen (name) + 1;
+  size_t offset;
+
+  if (!link_names_used)
+    link_names_used = 1;	/* Offset zero marks free slots.  */
+  if (link_names_alloc < link_names_used + size)
+    {
+      if (link_names_used / 2 < link_names_free)
+	link_names_compact ();
+      if (link_names_alloc < link_names_used + size)
+	{
+	  do
+	    link_names = x2realloc (link_names, &link_names_alloc);
+	  while (link_names_alloc < link_names_used + size);
+	  link_memory_update ();
+	}
+    }
+
+  offset = link_names_used;
+  memcpy (link_names + offset, name, size);
+  link_names_used += size;
+  return offset;
+}
+
+/* Remove the entry LP, all of whose links have been seen.  Slots
+   following it are moved back, so that no probe sequence is broken.  */
+static void
+link_remove (struct link *lp)
+{
+  size_t mask = link_slots - 1;
+  size_t i = lp - link_table;
+  size_t j;
+
+  link_names_free += strlen (link_names + lp->name) + 1;
+  link_count--;
+
+  for (j = (i + 1) & mask; link_table[j].name; j = (j + 1) & mask)
+    {
+      size_t home = link_hash (link_table[j].dev, link_table[j].ino);
+
+      /* Move the entry at J into the hole at I, unless its home slot
+	 lies cyclically in (I, J].  */
+      if (i <= j ? (home <= i || j < home) : (home <= i && j < home))
+	{
+	  link_table[i] = link_table[j];
+	  i = j;
+	}
+    }
+  link_table[i].name = 0;
+}
+
+/* Write a link header for ST, whose link target is LINK_NAME.
+   DUPLICATE is true if ST is not a hard link to its target, but has
+   the same contents.  Return true if successful.  */
+static bool
+dump_link_header (struct tar_stat_info *st, char const *link_name,
+		  bool duplicate)
+{
+  off_t block_ordinal;
+  union block *blk;
+
+  block_ordinal = current_block_ordinal ();
+  assign_string (&st->link_name, link_name);
+  if (NAME_FIELD_SIZE - (archive_format == OLDGNU_FORMAT)
+      < strlen (link_name))
+    write_long_link (st);
+
+  st->stat.st_size = 0;
+  blk = start_header (st);
+  if (!blk)
+    return false;
+  tar_copy_str (blk->header.linkname, link_name, NAME_FIELD_SIZE);
+  if (duplicate && archive_format == POSIX_FORMAT)
+    xheader_store ("GNU.duplicate", st, NULL);
+
+  blk->header.typeflag = LNKTYPE;
+  finish_header (st, blk, block_ordinal);
+  return true;
+}
 
 /* Try to dump stat as a hard link to another file in the archive.
    Return true if successful.  */
@@ -1437,36 +2514,23 @@ dump_hard_link (struct tar_stat_info *st)
   if (link_table
       && (trivial_link_count < st->stat.st_nlink || remove_files_option))
     {
-      struct link lp;
       struct link *duplicate;
-      off_t block_ordinal;
-      union block *blk;
-
-      lp.ino = st->stat.st_ino;
-      lp.dev = st->stat.st_dev;
 
-      if ((duplicate = hash_lookup (link_table, &lp)))
+      if ((duplicate = link_lookup (st->stat.st_dev, st->stat.st_ino)))
 	{
 	  /* We found a link.  */
-	  char const *link_name = safer_name_suffix (duplicate->name, true,
-	                                             absolute_names_option);
+	  char const *link_name =
+	    safer_name_suffix (link_names + duplicate->name, true,
+			       absolute_names_option);
 
-	  duplicate->nlink--;
-
-	  block_ordinal = current_block_ordinal ();
-	  assign_string (&st->link_name, link_name);
-	  if (NAME_FIELD_SIZE - (archive_format == OLDGNU_FORMAT)
-	      < strlen (link_name))
-	    write_long_link (st);
-
-	  st->stat.st_size = 0;
-	  blk = start_header (st);
-	  if (!blk)
+	  if (!dump_link_header (st, link_name, false))
 	    return false;
-	  tar_copy_str (blk->header.linkname, link_name, NAME_FIELD_SIZE);
 
-	  blk->header.typeflag = LNKTYPE;
-	  finish_header (st, blk, block_ordinal);
+	  /* Forget the file once all its links are seen, unless it
+	     may be named again.  */
+	  if (duplicate->nlink && --duplicate->nlink == 0
+	      && trivial_link_count)
+	    link_remove (duplicate);
 
 	  if (remove_files_option)
 	    queue_deferred_unlink (st->orig_file_name, false);
@@ -1484,30 +2548,23 @@ file_count_links (struct tar_stat_info *st)
     return;
   if (trivial_link_count < st->stat.st_nlink)
     {
-      struct link *duplicate;
       char *linkname = NULL;
       struct link *lp;
 
+      if (link_lookup (st->stat.st_dev, st->stat.st_ino))
+	abort ();
+
       assign_string (&linkname, st->orig_file_name);
       transform_name (&linkname, XFORM_LINK);
 
-      lp = xmalloc (offsetof (struct link, name)
-				 + strlen (linkname) + 1);
+      link_table_grow ();
+      lp = link_free_slot (st->stat.st_dev, st->stat.st_ino);
       lp->ino = st->stat.st_ino;
       lp->dev = st->stat.st_dev;
-      lp->nlink = st->stat.st_nlink;
-      strcpy (lp->name, linkname);
+      lp->nlink = st->stat.st_nlink - 1;
+      lp->name = link_names_add (linkname);
       free (linkname);
-
-      if (! ((link_table
-	      || (link_table = hash_initialize (0, 0, hash_link,
-						compare_links, 0)))
-	     && (duplicate = hash_insert (link_table, lp))))
-	xalloc_die ();
-
-      if (duplicate != lp)
-	abort ();
-      lp->nlink--;
+      link_count++;
     }
 }
 
@@ -1516,19 +2573,339 @@ file_count_links (struct tar_stat_info *st)
 void
 check_links (void)
 {
-  struct link *lp;
+  size_t i;
+
+  for (i = 0; i < link_slots; i++)
+    {
+      struct link const *lp = &link_table[i];
+      if (lp->name && lp->nlink)
+	{
+	  WARN ((0, 0, _("Missing links to %s."),
+		 quote (link_names + lp->name)));
+	}
+    }
+}
+
+/* Content deduplication */
+
+/* A regular file already written to the archive, whose contents a
+   later file may duplicate.  */
+struct content
+{
+  dev_t dev;			/* Its device and inode number, */
+  ino_t ino;
+  struct timespec mtime;	/* and times when it was archived */
+  struct timespec ctime;
+  struct timespec atime;
+  int change_dir;		/* Working directory of FILE_NAME */
+  char *file_name;		/* Its name in the file system */
+  struct content *next;		/* Next file of the same group */
+  char name[1];			/* Its name in the archive */
+};
+
+/* The archived files of a given size, and given digest if DIGESTED.
+   Each size has a group of files whose digest is not known yet, which
+   is created with the first file of that size.  */
+struct content_group
+{
+  off_t size;
+  bool digested;
+  uintmax_t digest;
+  struct content *files;
+};
+
+/* Table of the groups of all the regular files archived so far with
+   --deduplicate.  The digest of a file is only computed once another
+   file of the same size is met, which moves it from the group of its
+   size to that of its digest.  Only files with equal sizes and digests
+   are compared byte by byte.  */
+static Hash_table *content_table;
+
+/* Buffers for reading the files being compared.  */
+enum { CONTENT_BUFSIZE = 64 * 1024 };
+static char *content_buffer[2];
+
+static size_t
+hash_content_group (void const *entry, size_t n_buckets)
+{
+  struct content_group const *g = entry;
+  uintmax_t h = g->size;
+  if (g->digested)
+    h ^= g->digest;
+  return h % n_buckets;
+}
+
+static bool
+compare_content_groups (void const *entry1, void const *entry2)
+{
+  struct content_group const *g1 = entry1;
+  struct content_group const *g2 = entry2;
+  return (g1->size == g2->size && g1->digested == g2->digested
+	  && (!g1->digested || g1->digest == g2->digest));
+}
+
+/* Read up to SIZE bytes of FD into content_buffer[I], and return the
+   number of bytes read, or 0 on error or premature end of file.  */
+static size_t
+content_read (int fd, int i, off_t size)
+{
+  size_t bufsize = size < CONTENT_BUFSIZE ? size : CONTENT_BUFSIZE;
+  size_t count;
+
+  if (!content_buffer[i])
+    content_buffer[i] = xmalloc (CONTENT_BUFSIZE + sizeof (uint64_t));
+  count = safe_read (fd, content_buffer[i], bufsize);
+  return count == bufsize ? count : 0;
+}
+
+/* Compute into *DIGEST a digest of the SIZE bytes of FD, starting at
+   its beginning.  The digest only has to tell most different files
+   apart quickly, so it mixes in whole words at a time.  Return false
+   on read errors.  */
+static bool
+content_digest (int fd, off_t size, uintmax_t *digest)
+{
+  uint64_t h = size;
+
+  if (lseek (fd, 0, SEEK_SET) != 0)
+    return false;
+
+  while (size > 0)
+    {
+      size_t count = content_read (fd, 0, size);
+      char const *p = content_buffer[0];
+      char const *end;
+
+      if (!count)
+	return false;
+      size -= count;
+
+      /* Pad the last partial word with zeros.  */
+      memset (content_buffer[0] + count, 0, sizeof (uint64_t));
+      for (end = p + count; p < end; p += sizeof (uint64_t))
+	{
+	  uint64_t w;
+	  memcpy (&w, p, sizeof w);
+	  h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+	  h ^= h >> 29;
+	}
+    }
+
+  *digest = h;
+  return true;
+}
+
+/* Return true if the SIZE bytes of FD1 and FD2, starting at their
+   beginnings, are the same.  */
+static bool
+same_contents (int fd1, int fd2, off_t size)
+{
+  if (lseek (fd1, 0, SEEK_SET) != 0 || lseek (fd2, 0, SEEK_SET) != 0)
+    return false;
+
+  while (size > 0)
+    {
+      size_t count = content_read (fd1, 0, size);
+      if (!count || content_read (fd2, 1, size) != count
+	  || memcmp (content_buffer[0], content_buffer[1], count) != 0)
+	return false;
+      size -= count;
+    }
+  return true;
+}
+
+/* Open the file C for reading, and return its descriptor, or -1 if
+   it cannot be opened or has changed since it was archived.  */
+static int
+content_open (struct content const *c, off_t size)
+{
+  int saved_dir = chdir_current;
+  struct stat st;
+  int fd;
+
+  chdir_do (c->change_dir);
+  fd = openat (chdir_fd, c->file_name, open_read_flags);
+  chdir_do (saved_dir);
+  if (fd < 0)
+    return -1;
+
+  if (! (stat_fd (fd, &st, (STATX_TYPE | STATX_INO | STATX_SIZE
+			    | STATX_MTIME | STATX_CTIME)) == 0
+	 && S_ISREG (st.st_mode)
+	 && st.st_dev == c->dev && st.st_ino == c->ino
+	 && st.st_size == size
+	 && timespec_cmp (get_stat_mtime (&st), c->mtime) == 0
+	 && timespec_cmp (get_stat_ctime (&st), c->ctime) == 0))
+    {
+      close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+/* Close the descriptor FD of the file C, which has been read.  */
+static void
+content_close (struct content const *c, int fd)
+{
+  if (atime_preserve_option == replace_atime_preserve)
+    {
+      int saved_dir = chdir_current;
+      chdir_do (c->change_dir);
+      set_file_atime (fd, chdir_fd, c->file_name, c->atime);
+      chdir_do (saved_dir);
+    }
+  close (fd);
+}
 
-  if (!link_table)
+/* Return the group of the regular files of size SIZE archived so
+   far, and of digest *DIGEST unless DIGEST is null, creating it if
+   CREATE is true.  */
+static struct content_group *
+content_group (off_t size, uintmax_t const *digest, bool create)
+{
+  struct content_group key;
+  struct content_group *g;
+
+  key.size = size;
+  key.digested = digest != NULL;
+  key.digest = digest ? *digest : 0;
+  if (content_table)
+    {
+      g = hash_lookup (content_table, &key);
+      if (g || !create)
+	return g;
+    }
+  else if (!create)
+    return NULL;
+
+  g = xmalloc (sizeof *g);
+  *g = key;
+  g->files = NULL;
+  if (! ((content_table
+	  || (content_table = hash_initialize (0, 0, hash_content_group,
+					       compare_content_groups, 0)))
+	 && hash_insert (content_table, g) == g))
+    xalloc_die ();
+  return g;
+}
+
+static void
+content_free (struct content *c)
+{
+  free (c->file_name);
+  free (c);
+}
+
+/* Remember the regular file ST, which has just been archived, so
+   that later files with the same contents are archived as links to
+   it.  DIGEST is the digest of its contents, or null if unknown.  */
+static void
+content_add (struct tar_stat_info *st, uintmax_t const *digest)
+{
+  off_t size = st->stat.st_size;
+  struct content_group *g;
+  struct content *c;
+  char *linkname = NULL;
+
+  if (! (deduplicate_option && S_ISREG (st->stat.st_mode) && 0 < size))
     return;
 
-  for (lp = hash_get_first (link_table); lp;
-       lp = hash_get_next (link_table, lp))
+  assign_string (&linkname, st->orig_file_name);
+  transform_name (&linkname, XFORM_LINK);
+
+  g = content_group (size, NULL, true);
+  if (digest)
+    g = content_group (size, digest, true);
+  c = xmalloc (offsetof (struct content, name) + strlen (linkname) + 1);
+  c->dev = st->stat.st_dev;
+  c->ino = st->stat.st_ino;
+  c->mtime = st->mtime;
+  c->ctime = st->ctime;
+  c->atime = st->atime;
+  c->change_dir = chdir_current;
+  c->file_name = xstrdup (st->orig_file_name);
+  strcpy (c->name, linkname);
+  free (linkname);
+  c->next = g->files;
+  g->files = c;
+}
+
+/* Compute the digests of the files of group G, whose digests are
+   unknown, and move them to the groups of their digests.  Forget the
+   files that have changed since they were archived.  */
+static void
+content_digest_group (struct content_group *g)
+{
+  struct content *c;
+  struct content *next;
+
+  for (c = g->files; c; c = next)
+    {
+      uintmax_t digest;
+      int cfd = content_open (c, g->size);
+      bool digested = 0 <= cfd && content_digest (cfd, g->size, &digest);
+
+      next = c->next;
+      if (0 <= cfd)
+	content_close (c, cfd);
+      if (digested)
+	{
+	  struct content_group *dg = content_group (g->size, &digest, true);
+	  c->next = dg->files;
+	  dg->files = c;
+	}
+      else
+	content_free (c);
+    }
+  g->files = NULL;
+}
+
+/* Try to dump the regular file ST, open on FD, as a link to an
+   earlier file with the same contents.  Return true if successful.
+   Otherwise, FD is left positioned at its beginning, and if the
+   digest of its contents was computed, it is stored in *DIGEST and
+   *DIGESTED is set to true.  */
+static bool
+dump_duplicate (int fd, struct tar_stat_info *st,
+		uintmax_t *digest, bool *digested)
+{
+  off_t size = st->stat.st_size;
+  struct content_group *g;
+  struct content *c;
+  bool found = false;
+
+  if (! (deduplicate_option && S_ISREG (st->stat.st_mode) && 0 < size
+	 && content_group (size, NULL, false)))
+    return false;
+
+  if (content_digest (fd, size, digest))
     {
-      if (lp->nlink)
+      *digested = true;
+      content_digest_group (content_group (size, NULL, false));
+      g = content_group (size, digest, false);
+      for (c = g ? g->files : NULL; c; c = c->next)
 	{
-	  WARN ((0, 0, _("Missing links to %s."), quote (lp->name)));
+	  int cfd = content_open (c, size);
+	  if (cfd < 0)
+	    continue;
+	  found = same_contents (fd, cfd, size);
+	  content_close (c, cfd);
+	  if (found)
+	    break;
 	}
     }
+
+  if (found)
+    {
+      char const *link_name = safer_name_suffix (c->name, true,
+						 absolute_names_option);
+      if (dump_link_header (st, link_name, true))
+	return true;
+    }
+
+  if (lseek (fd, 0, SEEK_SET) != 0)
+    seek_diag_details (st->orig_file_name, 0);
+  return false;
 }
 
 /* Assuming DIR is the working directory, open FILE, using FLAGS to
@@ -1636,7 +3013,8 @@ dump_file0 (struct tar_stat_info *st, char const *name, char const *p)
       errno = - parentfd;
       diag = open_diag;
     }
-  else if (fstatat (parentfd, name, &st->stat, fstatat_flags) != 0)
+  else if (stat_at (parentfd, name, &st->stat, fstatat_flags,
+		    STATX_BASIC_STATS) != 0)
     diag = stat_diag;
   else if (file_dumpable_p (&st->stat))
     {
@@ -1646,7 +3024,7 @@ dump_file0 (struct tar_stat_info *st, char const *name, char const *p)
       else
 	{
 	  st->fd = fd;
-	  if (fstat (fd, &st->stat) != 0)
+	  if (stat_fd (fd, &st->stat, STATX_BASIC_STATS) != 0)
 	    diag = stat_diag;
 	}
     }
@@ -1714,17 +3092,37 @@ dump_file0 (struct tar_stat_info *st, char const *name, char const *p)
       if (is_dir)
 	{
 	  const char *tag_file_name;
+	  char *directory = NULL;
+	  unsigned char *types = NULL;
+	  int savedir_errno = 0;
 	  ensure_slash (&st->orig_file_name);
 	  ensure_slash (&st->file_name);
 
-	  if (check_exclusion_tags (st, &tag_file_name) == exclusion_tag_all)
+	  /* Read the entries first, so that exclusion tags are only
+	     looked up if they are among them.  They are not needed with
+	     --no-recursion.  */
+	  if (recursion_option
+	      && ! (directory = get_directory_entries (st, &types)))
+	    savedir_errno = errno;
+
+	  if (check_exclusion_tags (st, directory, &tag_file_name)
+	      == exclusion_tag_all)
 	    {
 	      exclusion_tag_warning (st->orig_file_name, tag_file_name,
 				     _("directory not dumped"));
+	      free (directory);
+	      free (types);
 	      return;
 	    }
 
-	  ok = dump_dir (st);
+	  ok = !savedir_errno;
+	  if (ok)
+	    dump_dir (st, directory, types);
+	  else
+	    {
+	      errno = savedir_errno;
+	      savedir_diag (st->orig_file_name);
+	    }
 
 	  fd = st->fd;
 	  parentfd = top_level ? chdir_fd : parent->fd;
@@ -1732,8 +3130,14 @@ dump_file0 (struct tar_stat_info *st, char const *name, char const *p)
       else
 	{
 	  enum dump_status status;
-
-	  if (fd && sparse_option && ST_IS_SPARSE (st->stat))
+	  uintmax_t digest;
+	  bool digested = false;
+	  bool duplicate = (0 < fd
+			    && dump_duplicate (fd, st, &digest, &digested));
+
+	  if (duplicate)
+	    status = dump_status_ok;
+	  else if (fd && sparse_option && ST_IS_SPARSE (st->stat))
 	    {
 	      status = sparse_dump_file (fd, st);
 	      if (status == dump_status_not_implemented)
@@ -1745,6 +3149,9 @@ dump_file0 (struct tar_stat_info *st, char const *name, char const *p)
 	  switch (status)
 	    {
 	    case dump_status_ok:
+	      if (!duplicate)
+		content_add (st, digested ? &digest : NULL);
+	      /* Fall through.  */
 	    case dump_status_short:
 	      file_count_links (st);
 	      break;
@@ -1774,10 +3181,11 @@ dump_file0 (struct tar_stat_info *st, char const *name, char const *p)
 		  ok = false;
 		}
 	      else
-		ok = fstatat (parentfd, name, &final_stat, fstatat_flags) == 0;
+		ok = stat_at (parentfd, name, &final_stat, fstatat_flags,
+			      STATX_CTIME | STATX_SIZE) == 0;
 	    }
 	  else
-	    ok = fstat (fd, &final_stat) == 0;
+	    ok = stat_fd (fd, &final_stat, STATX_CTIME | STATX_SIZE) == 0;
 
 	  if (! ok)
 	    file_removed_diag (p, top_level, stat_diag);
@@ -563,7 +563,8 @@ file_newer_p (const char *file_name, struct stat const *stp,
 
   if (!stp)
     {
-      if (deref_stat (file_name, &st) != 0)
+      if (stat_at (chdir_fd, file_name, &st, fstatat_flags,
+		   STATX_TYPE | STATX_MTIME) != 0)
 	{
 	  if (errno != ENOENT)
 	    {
@@ -936,6 +937,9 @@ extract_file (char *file_name, int typeflag)
 		 & ~ (0 < same_owner_option ? S_IRWXG | S_IRWXO : 0));
   mode_t current_mode = 0;
   mode_t current_mode_mask = 0;
+  bool make_holes = sparse_option && !to_stdout_option && !to_command_option;
+  bool hole = false;
+  struct uring_stream *writer = NULL;
 
   if (to_stdout_option)
     fd = STDOUT_FILENO;
@@ -966,6 +970,14 @@ extract_file (char *file_name, int typeflag)
 	}
     }
 
+  if (io_uring_option && !make_holes && !to_stdout_option
+      && !to_command_option && !current_stat_info.is_sparse)
+    {
+      off_t offset = lseek (fd, 0, SEEK_CUR);
+      if (0 <= offset)
+	writer = uring_open_write (fd, offset, URING_CHUNK);
+    }
+
   mv_begin_read (&current_stat_info);
   if (current_stat_info.is_sparse)
     sparse_extract_file (fd, &current_stat_info, &size);
@@ -990,7 +1002,12 @@ extract_file (char *file_name, int typeflag)
 	if (written > size)
 	  written = size;
 	errno = 0;
-	count = full_write (fd, data_block->buffer, written);
+	count = (writer
+		 ? (uring_write (writer, data_block->buffer, written)
+		    ? written : 0)
+		 : make_holes
+		 ? sparse_write (fd, data_block->buffer, written, &hole)
+		 : full_write (fd, data_block->buffer, written));
 	size -= written;
 
 	set_next_block_after ((union block *)
@@ -1008,6 +1025,15 @@ extract_file (char *file_name, int typeflag)
 
   mv_end ();
 
+  /* Report an error in the queued writes, unless the loop did.  */
+  if (!uring_close (writer) && count == written)
+    write_error (file_name);
+
+  /* A file that ends with a hole was only sought over up to its end;
+     give it its size.  */
+  if (hole && sys_truncate (fd) != 0)
+    truncate_warn (file_name);
+
   /* If writing to stdout, don't try to do anything to the filename;
      it doesn't exist, or we don't want to touch it anyway.  */
 
@@ -1106,6 +1132,21 @@ create_placeholder_file (char *file_name, bool is_symlink, bool *interdir_made)
   return -1;
 }
 
+/* Return the delayed link whose placeholder is the file with status
+   ST in the current working directory, or NULL if there is none.  */
+static struct delayed_link *
+find_delayed_link (struct stat const *st)
+{
+  struct delayed_link *ds;
+  for (ds = delayed_link_head; ds; ds = ds->next)
+    if (ds->change_dir == chdir_current
+	&& ds->dev == st->st_dev
+	&& ds->ino == st->st_ino
+	&& timespec_cmp (ds->ctime, get_stat_ctime (st)) == 0)
+      return ds;
+  return NULL;
+}
+
 static int
 extract_link (char *file_name, int typeflag)
 {
@@ -1127,22 +1168,17 @@ extract_link (char *file_name, int typeflag)
 
       if (status == 0)
 	{
-	  struct delayed_link *ds = delayed_link_head;
-	  if (ds
-	      && fstatat (chdir_fd, link_name, &st1, AT_SYMLINK_NOFOLLOW) == 0)
-	    for (; ds; ds = ds->next)
-	      if (ds->change_dir == chdir_current
-		  && ds->dev == st1.st_dev
-		  && ds->ino == st1.st_ino
-		  && timespec_cmp (ds->ctime, get_stat_ctime (&st1)) == 0)
-		{
-		  struct string_list *p =  xmalloc (offsetof (struct string_list, string)
-						    + strlen (file_name) + 1);
-		  strcpy (p->string, file_name);
-		  p->next = ds->sources;
-		  ds->sources = p;
-		  break;
-		}
+	  struct delayed_link *ds;
+	  if (delayed_link_head
+	      && fstatat (chdir_fd, link_name, &st1, AT_SYMLINK_NOFOLLOW) == 0
+	      && (ds = find_delayed_link (&st1)))
+	    {
+	      struct string_list *p =  xmalloc (offsetof (struct string_list, string)
+						+ strlen (file_name) + 1);
+	      strcpy (p->string, file_name);
+	      p->next = ds->sources;
+	      ds->sources = p;
+	    }
 	  return 0;
 	}
       else if ((e == EEXIST && strcmp (link_name, file_name) == 0)
@@ -1169,6 +1205,95 @@ extract_link (char *file_name, int typeflag)
   return 0;
 }
 
+/* Extract the link FILE_NAME as a copy of its target, which should be
+   an already extracted regular file with the same contents.  If the
+   target is anything else, e.g. a placeholder for a delayed symbolic
+   link, a FIFO or a device, extract FILE_NAME as a hard link.  */
+static int
+extract_copy (char *file_name, int typeflag)
+{
+  char const *link_name = current_stat_info.link_name;
+  bool interdir_made = false;
+  mode_t mode = (current_stat_info.stat.st_mode & MODE_RWX
+		 & ~ (0 < same_owner_option ? S_IRWXG | S_IRWXO : 0));
+  mode_t current_mode = 0;
+  mode_t current_mode_mask = 0;
+  char buf[BLOCKSIZE * 16];
+  size_t count;
+  struct stat st;
+  int ifd, fd;
+  int status = 0;
+
+  if (fstatat (chdir_fd, link_name, &st, AT_SYMLINK_NOFOLLOW) != 0
+      || !S_ISREG (st.st_mode)
+      || (delayed_link_head && find_delayed_link (&st)))
+    return extract_link (file_name, typeflag);
+
+  /* The target may have been replaced since it was examined, so do
+     not follow symbolic links or wait on FIFOs when opening it, and
+     check what was opened.  */
+  ifd = openat (chdir_fd, link_name,
+		open_read_flags | O_NOFOLLOW | O_NONBLOCK);
+  if (ifd < 0)
+    {
+      if (errno == ELOOP)
+	return extract_link (file_name, typeflag);
+      open_error (link_name);
+      return 1;
+    }
+  if (fstat (ifd, &st) != 0 || !S_ISREG (st.st_mode))
+    {
+      close (ifd);
+      return extract_link (file_name, typeflag);
+    }
+
+  while ((fd = open_output_file (file_name, REGTYPE, mode,
+				 &current_mode, &current_mode_mask))
+	 < 0)
+    {
+      int recover = maybe_recoverable (file_name, true, &interdir_made);
+      if (recover != RECOVER_OK)
+	{
+	  close (ifd);
+	  if (recover == RECOVER_SKIP)
+	    return 0;
+	  open_error (file_name);
+	  return 1;
+	}
+    }
+
+  while ((count = safe_read (ifd, buf, sizeof buf)) != 0)
+    {
+      size_t written;
+      if (count == SAFE_READ_ERROR)
+	{
+	  read_error (link_name);
+	  status = 1;
+	  break;
+	}
+      written = full_write (fd, buf, count);
+      if (written != count)
+	{
+	  write_error_details (file_name, written, count);
+	  status = 1;
+	  break;
+	}
+    }
+  close (ifd);
+
+  set_stat (file_name, &current_stat_info, fd,
+	    current_mode, current_mode_mask, REGTYPE, false,
+	    (old_files_option == OVERWRITE_OLD_FILES
+	     ? 0 : AT_SYMLINK_NOFOLLOW));
+
+  if (close (fd) < 0)
+    {
+      close_error (file_name);
+      status = 1;
+    }
+  return status;
+}
+
 static int
 extract_symlink (char *file_name, int typeflag)
 {
@@ -1326,7 +1451,27 @@ prepare_to_extract (char const *file_name, int typeflag, tar_extractor_t *fun)
       break;
 
     case LNKTYPE:
-      *fun = extract_link;
+      /* Only POSIX archives mark the links created by --deduplicate;
+	 in other formats they cannot be told apart from hard links,
+	 which must stay links.  Links whose targets could be outside
+	 the working directory are left to extract_link.  */
+      if (copy_duplicates_option && current_format != POSIX_FORMAT)
+	{
+	  static bool warned;
+	  if (!warned)
+	    {
+	      WARN ((0, 0, _("--copy-duplicates ignored: only POSIX archives"
+			     " mark the links made by --deduplicate")));
+	      warned = true;
+	    }
+	}
+      if (copy_duplicates_option
+	  && current_stat_info.is_duplicate
+	  && (absolute_names_option
+	      || !contains_dot_dot (current_stat_info.link_name)))
+	*fun = extract_copy;
+      else
+	*fun = extract_link;
       break;
 
 #if S_IFCHR
@@ -561,7 +561,7 @@ procdir (const char *name_buffer, struct tar_stat_info *st,
     {
       const char *tag_file_name;
 
-      switch (check_exclusion_tags (st, &tag_file_name))
+      switch (check_exclusion_tags (st, NULL, &tag_file_name))
 	{
 	case exclusion_tag_all:
 	  /* This warning can be duplicated by code in dump_file0, but only
@@ -670,12 +670,31 @@ makedumpdir (struct directory *directory, const char *dir)
   free (array);
 }
 
+/* The type of a directory entry, for looking it up by name.  */
+struct entry_type
+{
+  char const *name;
+  unsigned char type;
+};
+
+static int
+compare_entry_types (const void *a, const void *b)
+{
+  struct entry_type const *p = a;
+  struct entry_type const *q = b;
+  return strcmp (p->name, q->name);
+}
+
 /* Recursively scan the directory identified by ST.  */
 struct directory *
 scan_directory (struct tar_stat_info *st)
 {
   char const *dir = st->orig_file_name;
-  char *dirp = get_directory_entries (st);
+  unsigned char *types = NULL;
+  char *dirp = get_directory_entries (st, &types);
+  struct entry_type *entry_types = NULL;
+  size_t entry_count = 0;
+  char const *name;
   dev_t device = st->stat.st_dev;
   bool cmdline = ! st->parent;
   namebuf_t nbuf;
@@ -704,6 +723,20 @@ scan_directory (struct tar_stat_info *st)
 
       makedumpdir (directory, dirp);
 
+      /* Index the types of the entries, which spare the status of the
+	 subdirectories.  */
+      for (name = dirp; *name; name += strlen (name) + 1)
+	entry_count++;
+      entry_types = xnmalloc (entry_count, sizeof *entry_types);
+      for (name = dirp, entry_count = 0; *name;
+	   name += strlen (name) + 1, entry_count++)
+	{
+	  entry_types[entry_count].name = name;
+	  entry_types[entry_count].type = types[entry_count];
+	}
+      qsort (entry_types, entry_count, sizeof *entry_types,
+	     compare_entry_types);
+
       for (entry = dumpdir_first (directory->dump, 1, &itr);
 	   entry;
 	   entry = dumpdir_next (itr))
@@ -719,16 +752,28 @@ scan_directory (struct tar_stat_info *st)
 	      int fd = st->fd;
 	      void (*diag) (char const *) = 0;
 	      struct tar_stat_info stsub;
+	      struct entry_type key;
+	      struct entry_type const *found;
+	      bool is_dir;
 	      tar_stat_init (&stsub);
 
+	      key.name = entry + 1;
+	      found = bsearch (&key, entry_types, entry_count,
+			       sizeof *entry_types, compare_entry_types);
+	      is_dir = found && found->type == DT_DIR;
+
+	      /* Subdirectories known from their type get their status
+		 from fstat once they are open.  */
 	      if (fd < 0)
 		{
 		  errno = - fd;
 		  diag = open_diag;
 		}
-	      else if (fstatat (fd, entry + 1, &stsub.stat, fstatat_flags) != 0)
+	      else if (!is_dir
+		       && stat_at (fd, entry + 1, &stsub.stat, fstatat_flags,
+				   STATX_TYPE | STATX_MTIME | STATX_CTIME) != 0)
 		diag = stat_diag;
-	      else if (S_ISDIR (stsub.stat.st_mode))
+	      else if (is_dir || S_ISDIR (stsub.stat.st_mode))
 		{
 		  int subfd = subfile_open (st, entry + 1, open_read_flags);
 		  if (subfd < 0)
@@ -779,6 +824,8 @@ scan_directory (struct tar_stat_info *st)
 
   namebuf_free (nbuf);
 
+  free (entry_types);
+  free (types);
   free (dirp);
 
   return directory;
@@ -25,6 +25,10 @@
 
 #include "common.h"
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 #define max(a, b) ((a) < (b) ? (b) : (a))
 
 union block *current_header;	/* points to current archive header */
@@ -300,6 +304,63 @@ list_archive (void)
   skip_member ();
 }
 
+/* Return the sum of the bytes of BLOCK, taken as unsigned.  If
+   SIGNED_SUM is not null, store into it their sum taken as signed.
+   Where SSE2 is available, the sums of each 16 bytes are computed at
+   once; otherwise 8 bytes are added at a time, in 16-bit lanes of a
+   64-bit word.  The signed sum is obtained from the unsigned sum of
+   the bytes with their top bit flipped, which offsets each byte by
+   128.  */
+unsigned int
+block_sum (union block const *block, int *signed_sum)
+{
+  unsigned int usum;
+  unsigned int flipped;
+  size_t i;
+
+#ifdef __SSE2__
+  __m128i const zero = _mm_setzero_si128 ();
+  __m128i const top = _mm_set1_epi8 (-128);
+  __m128i acc = zero;
+  __m128i facc = zero;
+
+  for (i = 0; i < sizeof *block; i += sizeof acc)
+    {
+      __m128i v = _mm_loadu_si128 ((__m128i const *) (block->buffer + i));
+      acc = _mm_add_epi64 (acc, _mm_sad_epu8 (v, zero));
+      facc = _mm_add_epi64 (facc, _mm_sad_epu8 (_mm_xor_si128 (v, top),
+						zero));
+    }
+  usum = _mm_cvtsi128_si32 (acc) + _mm_cvtsi128_si32 (_mm_srli_si128 (acc, 8));
+  flipped = (_mm_cvtsi128_si32 (facc)
+	     + _mm_cvtsi128_si32 (_mm_srli_si128 (facc, 8)));
+#else
+  uint64_t const mask = 0x00FF00FF00FF00FFULL;
+  uint64_t const top = 0x8080808080808080ULL;
+  uint64_t acc = 0;
+  uint64_t facc = 0;
+
+  /* A lane gets at most 2 * 64 * 255 < 2**16 from a block.  */
+  for (i = 0; i < sizeof *block; i += sizeof acc)
+    {
+      uint64_t w;
+      memcpy (&w, block->buffer + i, sizeof w);
+      acc += (w & mask) + (w >> 8 & mask);
+      w ^= top;
+      facc += (w & mask) + (w >> 8 & mask);
+    }
+  acc = (acc & 0x0000FFFF0000FFFFULL) + (acc >> 16 & 0x0000FFFF0000FFFFULL);
+  usum = (acc & 0xFFFFFFFF) + (acc >> 32);
+  facc = ((facc & 0x0000FFFF0000FFFFULL)
+	  + (facc >> 16 & 0x0000FFFF0000FFFFULL));
+  flipped = (facc & 0xFFFFFFFF) + (facc >> 32);
+#endif
+
+  if (signed_sum)
+    *signed_sum = (int) flipped - 128 * (int) sizeof *block;
+  return usum;
+}
+
 /* Check header checksum */
 /* The standard BSD tar sources create the checksum by adding up the
    bytes in the header as type char.  I think the type char was unsigned
@@ -314,18 +375,12 @@ enum read_header
 tar_checksum (union block *header, bool silent)
 {
   size_t i;
-  int unsigned_sum = 0;		/* the POSIX one :-) */
-  int signed_sum = 0;		/* the Sun one :-( */
+  int unsigned_sum;		/* the POSIX one :-) */
+  int signed_sum;		/* the Sun one :-( */
   int recorded_sum;
   uintmax_t parsed_sum;
-  char *p;
 
-  p = header->buffer;
-  for (i = sizeof *header; i-- != 0;)
-    {
-      unsigned_sum += (unsigned char) *p;
-      signed_sum += (signed char) (*p++);
-    }
+  unsigned_sum = block_sum (header, &signed_sum);
 
   if (unsigned_sum == 0)
     return HEADER_ZERO_BLOCK;
@@ -692,6 +747,22 @@ from_header (char const *where0, size_t digs, char const *type,
   char const *lim = where + digs;
   int negative = 0;
 
+  /* Fast path for the common case of a field that starts with octal
+     digits, which fit in VALUE and the range, followed by a NUL, by a
+     blank, or by the end of the field.  Anything else is left to the
+     code below, which diagnoses it.  */
+  if (digs <= (sizeof value * CHAR_BIT - 1) / LG_8)
+    {
+      size_t i;
+      value = 0;
+      for (i = 0; i < digs && ISODIGIT (where[i]); i++)
+	value = value << LG_8 | (where[i] - '0');
+      if (i != 0
+	  && (i == digs || !where[i] || ISSPACE ((unsigned char) where[i]))
+	  && value <= maxval)
+	return value;
+    }
+
   /* Accommodate buggy tar of unknown vintage, which outputs leading
      NUL if the previous field overflows.  */
   where += !*where;
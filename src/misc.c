@@ -25,6 +25,10 @@
 #include <unlinkdir.h>
 #include <utimens.h>
 
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
 #ifndef DOUBLE_SLASH_IS_DISTINCT_ROOT
 # define DOUBLE_SLASH_IS_DISTINCT_ROOT 0
 #endif
@@ -607,6 +611,83 @@ undo_last_backup (void)
     }
 }
 
+#if USE_STATX
+/* Set to true if the kernel lacks statx.  */
+static bool statx_unsupported;
+
+/* Call statx (DIRFD, NAME, FLAGS, MASK) and fill in BUF with its
+   result.  The fields outside MASK are copied as the kernel returned
+   them, whether it brought them up to date or not.  */
+static int
+do_statx (int dirfd, char const *name, struct stat *buf, int flags,
+	  unsigned int mask)
+{
+  struct statx stx;
+  int status = statx (dirfd, name, flags, mask, &stx);
+
+  if (status != 0)
+    {
+      if (errno == ENOSYS)
+	statx_unsupported = true;
+      return status;
+    }
+
+  memset (buf, 0, sizeof *buf);
+  buf->st_dev = makedev (stx.stx_dev_major, stx.stx_dev_minor);
+  buf->st_rdev = makedev (stx.stx_rdev_major, stx.stx_rdev_minor);
+  buf->st_ino = stx.stx_ino;
+  buf->st_mode = stx.stx_mode;
+  buf->st_nlink = stx.stx_nlink;
+  buf->st_uid = stx.stx_uid;
+  buf->st_gid = stx.stx_gid;
+  buf->st_size = stx.stx_size;
+  buf->st_blksize = stx.stx_blksize;
+  buf->st_blocks = stx.stx_blocks;
+  buf->st_atim.tv_sec = stx.stx_atime.tv_sec;
+  buf->st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+  buf->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+  buf->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+  buf->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+  buf->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+  return 0;
+}
+#endif
+
+/* Get the status of NAME in the directory DIRFD into BUF, as fstatat
+   with FLAGS.  MASK is the set of STATX_* fields the caller needs: on
+   network file systems the others need not be brought up to date, so
+   the caller must not rely on them.  */
+int
+stat_at (int dirfd, char const *name, struct stat *buf, int flags,
+	 unsigned int mask)
+{
+#if USE_STATX
+  if (!statx_unsupported)
+    {
+      int status = do_statx (dirfd, name, buf, flags, mask);
+      if (! (status != 0 && statx_unsupported))
+	return status;
+    }
+#endif
+  return fstatat (dirfd, name, buf, flags);
+}
+
+/* Get the status of the open file FD into BUF, as fstat.  MASK is as
+   for stat_at.  */
+int
+stat_fd (int fd, struct stat *buf, unsigned int mask)
+{
+#if USE_STATX
+  if (!statx_unsupported)
+    {
+      int status = do_statx (fd, "", buf, AT_EMPTY_PATH, mask);
+      if (! (status != 0 && statx_unsupported))
+	return status;
+    }
+#endif
+  return fstat (fd, buf);
+}
+
 /* Apply either stat or lstat to (NAME, BUF), depending on the
    presence of the --dereference option.  NAME is relative to the
    most-recent argument to chdir_do.  */
@@ -627,6 +708,38 @@ set_file_atime (int fd, int parentfd, char const *file, struct timespec atime)
   return fdutimensat (fd, parentfd, file, ts, fstatat_flags);
 }
 
+/* Number of bytes the system is asked to read ahead of a file being
+   read sequentially.  Keeping a window this large scheduled lets the
+   device work on several reads at once, while tar copies data from the
+   page cache.  */
+enum { READ_ADVICE_WINDOW = 4 * 1024 * 1024 };
+
+/* The file open on FD is read sequentially, and OFFSET has been
+   reached.  ADVISED is the offset up to which the system was already
+   asked to read ahead, or -1 if the reading has just started.  Ask for
+   the next window if less than half of the current one is left, and
+   return the new value of ADVISED.  This is only a hint: it does not
+   matter if the system cannot honor it.  */
+off_t
+advise_sequential_read (int fd, off_t offset, off_t advised)
+{
+#if defined POSIX_FADV_SEQUENTIAL && defined POSIX_FADV_WILLNEED
+  if (advised < 0)
+    {
+      posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      advised = offset;
+    }
+  if (advised - offset < READ_ADVICE_WINDOW / 2)
+    {
+      off_t start = advised < offset ? offset : advised;
+      posix_fadvise (fd, start, offset + READ_ADVICE_WINDOW - start,
+		     POSIX_FADV_WILLNEED);
+      advised = offset + READ_ADVICE_WINDOW;
+    }
+#endif
+  return advised;
+}
+
 /* A description of a working directory.  */
 struct wd
 {
@@ -893,18 +1006,36 @@ ptr_align (void *ptr, size_t alignment)
   return p1 - (size_t) p1 % alignment;
 }
 
+/* Size of a huge page on common systems.  */
+enum { HUGE_PAGE_SIZE = 2 * 1024 * 1024 };
+
 /* Return the address of a page-aligned buffer of at least SIZE bytes.
-   The caller should free *PTR when done with the buffer.  */
+   The caller should free *PTR when done with the buffer.  Buffers of
+   a huge page or more are aligned on huge page boundaries, and backed
+   by huge pages where the system supports them, which saves TLB misses
+   when copying large records.  */
 
 void *
 page_aligned_alloc (void **ptr, size_t size)
 {
   size_t alignment = getpagesize ();
-  size_t size1 = size + alignment;
+  size_t size1;
+  void *p;
+
+#ifdef MADV_HUGEPAGE
+  if (HUGE_PAGE_SIZE <= size)
+    alignment = HUGE_PAGE_SIZE;
+#endif
+  size1 = size + alignment;
   if (size1 < size)
     xalloc_die ();
   *ptr = xmalloc (size1);
-  return ptr_align (*ptr, alignment);
+  p = ptr_align (*ptr, alignment);
+#ifdef MADV_HUGEPAGE
+  if (alignment == HUGE_PAGE_SIZE)
+    madvise (p, size - size % HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+#endif
+  return p;
 }
 
 
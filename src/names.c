@@ -32,108 +32,174 @@
    This code should also be modified for non-UNIX systems to do something
    reasonable.  */
 
-static char *cached_uname;
-static char *cached_gname;
+/* An entry of the caches of user and group names.  The caches
+   indexed by ID map it to its NAME, and those indexed by name map it
+   to its ID.  FOUND is false if the system knows nothing about the
+   key, so that it is not asked again.  MAPPED is true if the entry
+   comes from a file given by --passwd-file or --group-file.  */
+struct id_entry
+{
+  uintmax_t id;
+  char *name;
+  bool found;
+  bool mapped;
+};
 
-static uid_t cached_uid;	/* valid only if cached_uname is not empty */
-static gid_t cached_gid;	/* valid only if cached_gname is not empty */
+static Hash_table *uid_cache;	/* uid_t to user name */
+static Hash_table *uname_cache;	/* user name to uid_t */
+static Hash_table *gid_cache;	/* gid_t to group name */
+static Hash_table *gname_cache;	/* group name to gid_t */
 
-/* These variables are valid only if nonempty.  */
-static char *cached_no_such_uname;
-static char *cached_no_such_gname;
+/* True if users, respectively groups, are looked up in the files
+   given by --passwd-file and --group-file instead of the system
+   databases.  */
+static bool passwd_file_read;
+static bool group_file_read;
 
-/* These variables are valid only if nonzero.  It's not worth optimizing
-   the case for weird systems where 0 is not a valid uid or gid.  */
-static uid_t cached_no_such_uid;
-static gid_t cached_no_such_gid;
+static size_t
+id_entry_hash_id (void const *entry, size_t n_buckets)
+{
+  struct id_entry const *e = entry;
+  return e->id % n_buckets;
+}
 
-/* Given UID, find the corresponding UNAME.  */
-void
-uid_to_uname (uid_t uid, char **uname)
+static bool
+id_entry_compare_id (void const *entry1, void const *entry2)
 {
-  struct passwd *passwd;
+  struct id_entry const *e1 = entry1;
+  struct id_entry const *e2 = entry2;
+  return e1->id == e2->id;
+}
 
-  if (uid != 0 && uid == cached_no_such_uid)
-    {
-      *uname = xstrdup ("");
-      return;
-    }
+static size_t
+id_entry_hash_name (void const *entry, size_t n_buckets)
+{
+  struct id_entry const *e = entry;
+  return hash_string (e->name, n_buckets);
+}
+
+static bool
+id_entry_compare_name (void const *entry1, void const *entry2)
+{
+  struct id_entry const *e1 = entry1;
+  struct id_entry const *e2 = entry2;
+  return strcmp (e1->name, e2->name) == 0;
+}
+
+/* Look up the entry of ID in TABLE, which is indexed by ID.  */
+static struct id_entry *
+id_cache_find_id (Hash_table *table, uintmax_t id)
+{
+  struct id_entry key;
+  if (!table)
+    return NULL;
+  key.id = id;
+  return hash_lookup (table, &key);
+}
 
-  if (!cached_uname || uid != cached_uid)
+/* Look up the entry of NAME in TABLE, which is indexed by name.  */
+static struct id_entry *
+id_cache_find_name (Hash_table *table, char const *name)
+{
+  struct id_entry key;
+  if (!table)
+    return NULL;
+  key.name = (char *) name;
+  return hash_lookup (table, &key);
+}
+
+/* Add to *TABLE the entry mapping ID and NAME, which tells whether
+   they were FOUND, and return it.  BY_NAME tells whether *TABLE is
+   indexed by name or by ID, and MAPPED whether the entry comes from a
+   file.  If the table already has an entry for the same key, it is
+   kept and returned instead, unless only the new entry comes from a
+   file: the files take precedence over what the system said.  */
+static struct id_entry *
+id_cache_add (Hash_table **table, bool by_name,
+	      uintmax_t id, char const *name, bool found, bool mapped)
+{
+  size_t len = strlen (name) + 1;
+  struct id_entry *e = xmalloc (sizeof *e + len);
+  struct id_entry *ret;
+
+  e->id = id;
+  e->name = memcpy (e + 1, name, len);
+  e->found = found;
+  e->mapped = mapped;
+
+  if (!*table
+      && !(*table = hash_initialize (0, 0,
+				     (by_name
+				      ? id_entry_hash_name
+				      : id_entry_hash_id),
+				     (by_name
+				      ? id_entry_compare_name
+				      : id_entry_compare_id),
+				     free)))
+    xalloc_die ();
+  ret = hash_insert (*table, e);
+  if (!ret)
+    xalloc_die ();
+  if (ret != e)
     {
-      passwd = getpwuid (uid);
-      if (passwd)
+      if (mapped && !ret->mapped)
 	{
-	  cached_uid = uid;
-	  assign_string (&cached_uname, passwd->pw_name);
+	  free (hash_delete (*table, ret));
+	  if (hash_insert (*table, e) != e)
+	    xalloc_die ();
+	  ret = e;
 	}
       else
-	{
-	  cached_no_such_uid = uid;
-	  *uname = xstrdup ("");
-	  return;
-	}
+	free (e);
     }
-  *uname = xstrdup (cached_uname);
+  return ret;
 }
 
-/* Given GID, find the corresponding GNAME.  */
+/* Given UID, find the corresponding UNAME.  */
 void
-gid_to_gname (gid_t gid, char **gname)
+uid_to_uname (uid_t uid, char **uname)
 {
-  struct group *group;
+  struct id_entry *e = id_cache_find_id (uid_cache, uid);
 
-  if (gid != 0 && gid == cached_no_such_gid)
+  if (!e)
     {
-      *gname = xstrdup ("");
-      return;
+      struct passwd *passwd = passwd_file_read ? NULL : getpwuid (uid);
+      e = id_cache_add (&uid_cache, false, uid,
+			passwd ? passwd->pw_name : "", passwd != NULL, false);
     }
+  *uname = xstrdup (e->name);
+}
+
+/* Given GID, find the corresponding GNAME.  */
+void
+gid_to_gname (gid_t gid, char **gname)
+{
+  struct id_entry *e = id_cache_find_id (gid_cache, gid);
 
-  if (!cached_gname || gid != cached_gid)
+  if (!e)
     {
-      group = getgrgid (gid);
-      if (group)
-	{
-	  cached_gid = gid;
-	  assign_string (&cached_gname, group->gr_name);
-	}
-      else
-	{
-	  cached_no_such_gid = gid;
-	  *gname = xstrdup ("");
-	  return;
-	}
+      struct group *group = group_file_read ? NULL : getgrgid (gid);
+      e = id_cache_add (&gid_cache, false, gid,
+			group ? group->gr_name : "", group != NULL, false);
     }
-  *gname = xstrdup (cached_gname);
+  *gname = xstrdup (e->name);
 }
 
 /* Given UNAME, set the corresponding UID and return 1, or else, return 0.  */
 int
 uname_to_uid (char const *uname, uid_t *uidp)
 {
-  struct passwd *passwd;
+  struct id_entry *e = id_cache_find_name (uname_cache, uname);
 
-  if (cached_no_such_uname
-      && strcmp (uname, cached_no_such_uname) == 0)
-    return 0;
-
-  if (!cached_uname
-      || uname[0] != cached_uname[0]
-      || strcmp (uname, cached_uname) != 0)
+  if (!e)
     {
-      passwd = getpwnam (uname);
-      if (passwd)
-	{
-	  cached_uid = passwd->pw_uid;
-	  assign_string (&cached_uname, passwd->pw_name);
-	}
-      else
-	{
-	  assign_string (&cached_no_such_uname, uname);
-	  return 0;
-	}
+      struct passwd *passwd = passwd_file_read ? NULL : getpwnam (uname);
+      e = id_cache_add (&uname_cache, true, passwd ? passwd->pw_uid : 0,
+			uname, passwd != NULL, false);
     }
-  *uidp = cached_uid;
+  if (!e->found)
+    return 0;
+  *uidp = e->id;
   return 1;
 }
 
@@ -141,33 +207,93 @@ uname_to_uid (char const *uname, uid_t *uidp)
 int
 gname_to_gid (char const *gname, gid_t *gidp)
 {
-  struct group *group;
+  struct id_entry *e = id_cache_find_name (gname_cache, gname);
 
-  if (cached_no_such_gname
-      && strcmp (gname, cached_no_such_gname) == 0)
+  if (!e)
+    {
+      struct group *group = group_file_read ? NULL : getgrnam (gname);
+      e = id_cache_add (&gname_cache, true, group ? group->gr_gid : 0,
+			gname, group != NULL, false);
+    }
+  if (!e->found)
     return 0;
+  *gidp = e->id;
+  return 1;
+}
 
-  if (!cached_gname
-      || gname[0] != cached_gname[0]
-      || strcmp (gname, cached_gname) != 0)
+/* Read the users, or the groups if GROUP is true, from FILE_NAME,
+   which is in the format of /etc/passwd, respectively /etc/group:
+   each line gives a name, a password and an ID, separated by colons,
+   followed by other fields that are ignored.  Empty lines and lines
+   starting with `#' are ignored, too.  From then on, users or groups
+   are looked up only in the files so read.  */
+void
+read_id_file (char const *file_name, bool group)
+{
+  FILE *fp = fopen (file_name, "r");
+  char *buf = NULL;
+  size_t bufsize = 0;
+  long lineno = 0;
+
+  if (!fp)
+    open_fatal (file_name);
+
+  while (0 < getline (&buf, &bufsize, fp))
     {
-      group = getgrnam (gname);
-      if (group)
+      char *name = buf;
+      char *p;
+      char *ebuf;
+      uintmax_t id;
+
+      lineno++;
+      if (*buf == '#' || *buf == '\n')
+	continue;
+
+      p = strchr (buf, ':');
+      if (p)
 	{
-	  cached_gid = group->gr_gid;
-	  assign_string (&cached_gname, gname);
+	  *p = 0;
+	  p = strchr (p + 1, ':');
 	}
-      else
+      if (!p || !*name)
+	FATAL_ERROR ((0, 0, "%s:%ld: %s", quotearg_colon (file_name), lineno,
+		      _("Malformed entry")));
+      p++;
+
+      errno = 0;
+      id = strtoumax (p, &ebuf, 10);
+      if (!ISDIGIT (*p))
 	{
-	  assign_string (&cached_no_such_gname, gname);
-	  return 0;
+	  ebuf = p;
+	  errno = 0;
 	}
+      else if (!errno
+	       && (group ? id != (gid_t) id : id != (uid_t) id))
+	errno = ERANGE;
+      if (ebuf == p || errno
+	  || !(*ebuf == ':' || *ebuf == '\n' || !*ebuf))
+	FATAL_ERROR ((0, errno, "%s:%ld: %s",
+		      quotearg_colon (file_name), lineno,
+		      group ? _("Invalid group ID") : _("Invalid user ID")));
+
+      id_cache_add (group ? &gid_cache : &uid_cache, false, id, name,
+		    true, true);
+      id_cache_add (group ? &gname_cache : &uname_cache, true, id, name,
+		    true, true);
     }
-  *gidp = cached_gid;
-  return 1;
+
+  if (ferror (fp))
+    read_fatal (file_name);
+  if (fclose (fp) != 0)
+    close_error (file_name);
+  free (buf);
+
+  if (group)
+    group_file_read = true;
+  else
+    passwd_file_read = true;
 }
 
-
 static struct name *
 make_name (const char *file_name)
 {
@@ -22,6 +22,10 @@
 #include <quotearg.h>
 #include "common.h"
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 struct tar_sparse_file;
 static bool sparse_select_optab (struct tar_sparse_file *file);
 
@@ -54,6 +58,8 @@ struct tar_sparse_file
 				       Otherwise unused */
   off_t dumped_size;                /* Number of bytes actually written
 				       to the archive */
+  off_t advised;                    /* Offset up to which the data to dump
+				       was requested to be read ahead */
   struct tar_stat_info *stat_info;  /* Information about the file */
   struct tar_sparse_optab const *optab; /* Operation table */
   void *closure;                    /* Any additional data optab calls might
@@ -105,6 +111,7 @@ static bool
 tar_sparse_init (struct tar_sparse_file *file)
 {
   memset (file, 0, sizeof *file);
+  file->advised = -1;
 
   if (!sparse_select_optab (file))
     return false;
@@ -188,10 +195,33 @@ lseek_or_error (struct tar_sparse_file *file, off_t offset)
 
 /* Takes a blockful of data and basically cruises through it to see if
    it's made *entirely* of zeros, returning a 0 the instant it finds
-   something that is a nonzero, i.e., useful data.  */
+   something that is a nonzero, i.e., useful data.  It looks at 64
+   bytes at a time, with SSE2 where available.  */
 static bool
 zero_block_p (char const *buffer, size_t size)
 {
+#ifdef __SSE2__
+  __m128i const zero = _mm_setzero_si128 ();
+  for (; 64 <= size; buffer += 64, size -= 64)
+    {
+      __m128i const *p = (__m128i const *) buffer;
+      __m128i v = _mm_or_si128 (_mm_or_si128 (_mm_loadu_si128 (p),
+					      _mm_loadu_si128 (p + 1)),
+				_mm_or_si128 (_mm_loadu_si128 (p + 2),
+					      _mm_loadu_si128 (p + 3)));
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (v, zero)) != 0xFFFF)
+	return false;
+    }
+#else
+  for (; 64 <= size; buffer += 64, size -= 64)
+    {
+      uint64_t w[8];
+      memcpy (w, buffer, sizeof w);
+      if (w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7])
+	return false;
+    }
+#endif
+
   while (size--)
     if (*buffer++)
       return false;
@@ -210,14 +240,166 @@ sparse_add_map (struct tar_stat_info *st, struct sp_array const *sp)
   st->sparse_map_avail = avail + 1;
 }
 
+/* Size of the windows in which files are read to find their blocks
+   of zeros.  */
+enum { SPARSE_SCAN_WINDOW = 2 * 1024 * 1024 };
+
+/* Add the COUNT bytes at OFFSET in BUFFER, which are all zeros if
+   ZERO, and otherwise are blocks that are not, to the map being built
+   in SP: zeros end the current data region, if any; other blocks are
+   added to it.  */
+static bool
+sparse_scan_run (struct tar_sparse_file *file, struct sp_array *sp,
+		 char *buffer, size_t count, off_t offset, bool zero)
+{
+  struct tar_stat_info *st = file->stat_info;
+
+  if (zero)
+    {
+      if (sp->numbytes)
+	{
+	  sparse_add_map (st, sp);
+	  sp->numbytes = 0;
+	  if (!tar_sparse_scan (file, scan_block, NULL))
+	    return false;
+	}
+    }
+  else
+    {
+      if (sp->numbytes == 0)
+	sp->offset = offset;
+      sp->numbytes += count;
+      st->archive_file_size += count;
+      if (!tar_sparse_scan (file, scan_block, buffer))
+	return false;
+    }
+  return true;
+}
+
+/* Read FILE from *OFFSET, its current position, up to END, in
+   windows, and add its blocks to the map being built in SP.  Adjacent
+   blocks of zeros, and adjacent blocks of data, are added together.
+   Advance *OFFSET past the bytes read.  Set *EOF if the end of the
+   file, or a read error, came before END.  */
+static bool
+sparse_scan_range (struct tar_sparse_file *file, struct sp_array *sp,
+		   off_t *offset, off_t end, bool *eof)
+{
+  static char *window;
+
+  if (!window)
+    window = xmalloc (SPARSE_SCAN_WINDOW);
+
+  *eof = false;
+  while (*offset < end)
+    {
+      size_t count = safe_read (file->fd, window,
+				(end - *offset < SPARSE_SCAN_WINDOW
+				 ? end - *offset : SPARSE_SCAN_WINDOW));
+      size_t start;
+      size_t i;
+
+      if (count == 0 || count == SAFE_READ_ERROR)
+	{
+	  *eof = true;
+	  break;
+	}
+
+      /* Find the runs of blocks of the same kind.  */
+      for (start = 0; start < count; start = i)
+	{
+	  size_t size = count - start < BLOCKSIZE ? count - start : BLOCKSIZE;
+	  bool zero = zero_block_p (window + start, size);
+
+	  for (i = start + size; i < count; i += size)
+	    {
+	      size = count - i < BLOCKSIZE ? count - i : BLOCKSIZE;
+	      if (zero_block_p (window + i, size) != zero)
+		break;
+	    }
+	  if (!sparse_scan_run (file, sp, window + start, i - start,
+				*offset + start, zero))
+	    return false;
+	}
+      *offset += count;
+    }
+  return true;
+}
+
+#if defined SEEK_DATA && defined SEEK_HOLE
+/* Scan the sparse file by asking the system where its data is, and
+   only reading the data regions, in which blocks of zeros still make
+   holes.  The map is thus the same as if the whole file was read, but
+   holes are not read.  Set *OFFSET to the end of the file.  Return
+   false if the system cannot tell where the data is, in which case
+   the file must be read as a whole.  */
+static bool
+sparse_scan_data (struct tar_sparse_file *file, struct sp_array *sp,
+		  off_t *offset)
+{
+  int fd = file->fd;
+  off_t data_offset = 0;
+  off_t end;
+
+  for (;;)
+    {
+      off_t data = lseek (fd, data_offset, SEEK_DATA);
+      off_t hole;
+      bool eof;
+
+      if (data < 0)
+	{
+	  if (errno == ENXIO)
+	    break;
+	  return false;
+	}
+      hole = lseek (fd, data, SEEK_HOLE);
+      if (hole < 0)
+	return false;
+
+      /* Keep to the blocks that reading the whole file would see.  */
+      data -= data % BLOCKSIZE;
+      if (hole % BLOCKSIZE)
+	hole += BLOCKSIZE - hole % BLOCKSIZE;
+
+      /* The blocks in between are a hole.  */
+      if (data_offset < data
+	  && !sparse_scan_run (file, sp, NULL, data - data_offset,
+			       data_offset, true))
+	return false;
+
+      if (lseek (fd, data, SEEK_SET) != data
+	  || !sparse_scan_range (file, sp, &data, hole, &eof))
+	return false;
+      if (eof)
+	{
+	  /* The end of the file, or the same error that would end
+	     reading it as a whole.  */
+	  *offset = data;
+	  return true;
+	}
+      data_offset = hole;
+    }
+
+  end = lseek (fd, 0, SEEK_END);
+  if (end < 0)
+    return false;
+
+  /* The file ends with a hole.  */
+  if (data_offset < end
+      && !sparse_scan_run (file, sp, NULL, end - data_offset,
+			   data_offset, true))
+    return false;
+  *offset = end;
+  return true;
+}
+#endif
+
 /* Scan the sparse file and create its map */
 static bool
 sparse_scan_file (struct tar_sparse_file *file)
 {
   struct tar_stat_info *st = file->stat_info;
-  int fd = file->fd;
-  char buffer[BLOCKSIZE];
-  size_t count = 0;
   off_t offset = 0;
   struct sp_array sp = {0, 0};
 
@@ -227,34 +409,31 @@ sparse_scan_file (struct tar_sparse_file *file)
     offset = st->stat.st_size;
   else
     {
+      bool scanned = false;
+
       if (!tar_sparse_scan (file, scan_begin, NULL))
 	return false;
 
-      while ((count = safe_read (fd, buffer, sizeof buffer)) != 0
-	     && count != SAFE_READ_ERROR)
+#if defined SEEK_DATA && defined SEEK_HOLE
+      scanned = sparse_scan_data (file, &sp, &offset);
+      if (!scanned)
 	{
-	  /* Analyze the block.  */
-	  if (zero_block_p (buffer, count))
-	    {
-	      if (sp.numbytes)
-		{
-		  sparse_add_map (st, &sp);
-		  sp.numbytes = 0;
-		  if (!tar_sparse_scan (file, scan_block, NULL))
-		    return false;
-		}
-	    }
-	  else
-	    {
-	      if (sp.numbytes == 0)
-		sp.offset = offset;
-	      sp.numbytes += count;
-	      st->archive_file_size += count;
-	      if (!tar_sparse_scan (file, scan_block, buffer))
-		return false;
-	    }
+	  /* Start over, reading the whole file.  */
+	  st->sparse_map_avail = 0;
+	  st->archive_file_size = 0;
+	  sp.offset = sp.numbytes = 0;
+	  offset = 0;
+	  if (lseek (file->fd, 0, SEEK_SET) != 0)
+	    return false;
+	}
+#endif
 
-	  offset += count;
+      if (!scanned)
+	{
+	  bool eof;
+	  if (!sparse_scan_range (file, &sp, &offset, TYPE_MAXIMUM (off_t),
+				  &eof))
+	    return false;
 	}
     }
 
@@ -262,7 +441,6 @@ sparse_scan_file (struct tar_sparse_file *file)
     sp.offset = offset;
 
   sparse_add_map (st, &sp);
-  st->archive_file_size += count;
   return tar_sparse_scan (file, scan_end, NULL);
 }
 
@@ -298,41 +476,79 @@ sparse_select_optab (struct tar_sparse_file *file)
   return true;
 }
 
+/* Dump the data region I of FILE, reading as much of it at a time
+   as the record buffer can take.  */
 static bool
 sparse_dump_region (struct tar_sparse_file *file, size_t i)
 {
   union block *blk;
+  off_t offset = file->stat_info->sparse_map[i].offset;
   off_t bytes_left = file->stat_info->sparse_map[i].numbytes;
+  struct uring_stream *reader = NULL;
+  bool ok = false;
 
-  if (!lseek_or_error (file, file->stat_info->sparse_map[i].offset))
+  if (!lseek_or_error (file, offset))
     return false;
 
+  if (file->seekable && io_uring_option)
+    reader = uring_open_read (file->fd, offset, bytes_left, URING_CHUNK);
+
   while (bytes_left > 0)
     {
-      size_t bufsize = (bytes_left > BLOCKSIZE) ? BLOCKSIZE : bytes_left;
+      size_t bufsize;
       size_t bytes_read;
+      size_t tail;
 
       blk = find_next_block ();
-      bytes_read = safe_read (file->fd, blk->buffer, bufsize);
+      bufsize = available_space_after (blk);
+      if (bytes_left < bufsize)
+	bufsize = bytes_left;
+      if (reader)
+	bytes_read = uring_read (reader, blk->buffer, bufsize);
+      else
+	{
+	  file->advised = advise_sequential_read (file->fd, offset,
+						  file->advised);
+	  bytes_read = safe_read (file->fd, blk->buffer, bufsize);
+	}
       if (bytes_read == SAFE_READ_ERROR)
 	{
           read_diag_details (file->stat_info->orig_file_name,
-	                     (file->stat_info->sparse_map[i].offset
-			      + file->stat_info->sparse_map[i].numbytes
-			      - bytes_left),
-			     bufsize);
-	  return false;
+	                     offset, bufsize);
+	  goto out;
+	}
+      if (bytes_read == 0)
+	{
+	  char buf[UINTMAX_STRSIZE_BOUND];
+	  WARNOPT (WARN_FILE_SHRANK,
+		   (0, 0,
+		    ngettext ("%s: File shrank by %s byte; padding with zeros",
+			      "%s: File shrank by %s bytes; padding with zeros",
+			      bytes_left),
+		    quotearg_colon (file->stat_info->orig_file_name),
+		    STRINGIFY_BIGINT (bytes_left, buf)));
+	  if (! ignore_failed_read_option)
+	    set_exit_status (TAREXIT_DIFFERS);
+	  goto out;
 	}
 
-      memset (blk->buffer + bytes_read, 0, BLOCKSIZE - bytes_read);
+      tail = bytes_read % BLOCKSIZE;
+      if (tail)
+	memset (blk->buffer + bytes_read, 0, BLOCKSIZE - tail);
+      offset += bytes_read;
       bytes_left -= bytes_read;
       file->dumped_size += bytes_read;
-      set_next_block_after (blk);
+      set_next_block_after (blk + (bytes_read - 1) / BLOCKSIZE);
     }
+  ok = true;
 
-  return true;
+ out:
+  uring_close (reader);
+  return ok;
 }
 
+/* Extract the data region I of FILE, writing as much of it at a time
+   as the record buffer holds.  */
 static bool
 sparse_extract_region (struct tar_sparse_file *file, size_t i)
 {
@@ -352,14 +568,17 @@ sparse_extract_region (struct tar_sparse_file *file, size_t i)
   else while (write_size > 0)
     {
       size_t count;
-      size_t wrbytes = (write_size > BLOCKSIZE) ? BLOCKSIZE : write_size;
+      size_t wrbytes;
       union block *blk = find_next_block ();
       if (!blk)
 	{
 	  ERROR ((0, 0, _("Unexpected EOF in archive")));
 	  return false;
 	}
-      set_next_block_after (blk);
+      wrbytes = available_space_after (blk);
+      if (write_size < wrbytes)
+	wrbytes = write_size;
+      set_next_block_after (blk + (wrbytes - 1) / BLOCKSIZE);
       count = full_write (file->fd, blk->buffer, wrbytes);
       write_size -= count;
       file->dumped_size += count;
@@ -375,7 +594,47 @@ sparse_extract_region (struct tar_sparse_file *file, size_t i)
   return true;
 }
 
-
+
+/* Write the COUNT bytes of BUFFER to FD, which is a new regular file,
+   seeking over the blocks of zeros in them instead of writing them,
+   so that they become holes.  Set *HOLE to true if BUFFER ends with
+   such a hole, which the caller must then make part of the file, by
+   truncating it to its size.  Return the number of bytes written or
+   skipped, which is less than COUNT on errors.  */
+size_t
+sparse_write (int fd, char const *buffer, size_t count, bool *hole)
+{
+  size_t start;
+  size_t i;
+
+  for (start = 0; start < count; start = i)
+    {
+      size_t size = count - start < BLOCKSIZE ? count - start : BLOCKSIZE;
+      bool zero = zero_block_p (buffer + start, size);
+
+      for (i = start + size; i < count; i += size)
+	{
+	  size = count - i < BLOCKSIZE ? count - i : BLOCKSIZE;
+	  if (zero_block_p (buffer + i, size) != zero)
+	    break;
+	}
+
+      if (zero)
+	{
+	  if (lseek (fd, i - start, SEEK_CUR) < 0)
+	    return start;
+	}
+      else
+	{
+	  size_t written = full_write (fd, buffer + start, i - start);
+	  if (written != i - start)
+	    return start + written;
+	}
+      *hole = zero;
+    }
+  return count;
+}
+
 
 /* Interface functions */
 enum dump_status
@@ -43,6 +43,8 @@ static struct compression_suffix compression_suffixes[] = {
   { S(tlz,  LZMA) },
   { S(lzo,  LZOP) },
   { S(xz,   XZ) },
+  { S(zst,  ZSTD) },
+  { S(tzst, ZSTD) },
 #undef S
 #undef __CAT2__
 };
@@ -21,6 +21,7 @@
 
 #include "common.h"
 #include <priv-set.h>
+#include <quotearg.h>
 #include <rmt.h>
 #include <signal.h>
 
@@ -57,6 +58,11 @@ sys_wait_for_child (pid_t child_pid, bool eof)
 {
 }
 
+void
+sys_stop_child (pid_t child_pid)
+{
+}
+
 void
 sys_spawn_shell (void)
 {
@@ -97,16 +103,27 @@ sys_write_archive_buffer (void)
   return full_write (archive, record_start->buffer, record_size);
 }
 
+void
+sys_direct_archive (void)
+{
+}
+
+off_t
+sys_copy_to_archive (int fd, char const *file_name, off_t size)
+{
+  return 0;
+}
+
 /* Set ARCHIVE for writing, then compressing an archive.  */
 void
-sys_child_open_for_compress (void)
+sys_child_open_for_compress (bool append)
 {
   FATAL_ERROR ((0, 0, _("Cannot use compressed or remote archives")));
 }
 
 /* Set ARCHIVE for uncompressing, then reading an archive.  */
 void
-sys_child_open_for_uncompress (void)
+sys_child_open_for_uncompress (off_t offset)
 {
   FATAL_ERROR ((0, 0, _("Cannot use compressed or remote archives")));
 }
@@ -183,6 +200,21 @@ sys_wait_for_child (pid_t child_pid, bool eof)
     }
 }
 
+/* Stop CHILD_PID, whose output is no longer needed.  */
+void
+sys_stop_child (pid_t child_pid)
+{
+  int wait_status;
+
+  kill (child_pid, SIGTERM);
+  while (waitpid (child_pid, &wait_status, 0) == -1)
+    if (errno != EINTR)
+      {
+	waitpid_error (use_compress_program_option);
+	break;
+      }
+}
+
 void
 sys_spawn_shell (void)
 {
@@ -235,23 +267,179 @@ sys_truncate (int fd)
   return pos < 0 ? -1 : ftruncate (fd, pos);
 }
 
-/* Return nonzero if NAME is the name of a regular file, or if the file
-   does not exist (so it would be created as a regular file).  */
-static int
-is_regular_file (const char *name)
+/* Return true if FD is a device, or cannot be examined.  The record
+   structure of such files must be kept when reading them.  */
+static bool
+is_device (int fd)
+{
+  struct stat stbuf;
+
+  return (fstat (fd, &stbuf) != 0
+	  || S_ISCHR (stbuf.st_mode) || S_ISBLK (stbuf.st_mode));
+}
+
+/* Return true if NAME is the name of a regular file, FIFO or socket,
+   or if the file does not exist (so it would be created as a regular
+   file).  A compression program can access such an archive directly.  */
+static bool
+is_stream_file (const char *name)
 {
   struct stat stbuf;
 
   if (stat (name, &stbuf) == 0)
-    return S_ISREG (stbuf.st_mode);
+    return (S_ISREG (stbuf.st_mode) || S_ISFIFO (stbuf.st_mode)
+	    || S_ISSOCK (stbuf.st_mode));
   else
     return errno == ENOENT;
 }
 
+/* Preferred capacity of the pipes between tar and a compression program.
+   Larger pipes let each side move more records at a time, with fewer
+   context switches between them.  */
+enum { COMPRESS_PIPE_SIZE = 1024 * 1024 };
+
+/* Enlarge the pipe FD to hold at least COMPRESS_PIPE_SIZE bytes and a
+   whole record, if the system allows it.  */
+static void
+enlarge_pipe (int fd)
+{
+#ifdef F_SETPIPE_SZ
+  size_t size = record_size < COMPRESS_PIPE_SIZE
+                ? COMPRESS_PIPE_SIZE : record_size;
+
+  if (size <= INT_MAX && fcntl (fd, F_SETPIPE_SZ, (int) size) < 0
+      && size != COMPRESS_PIPE_SIZE)
+    fcntl (fd, F_SETPIPE_SZ, COMPRESS_PIPE_SIZE);
+#endif
+}
+
+/* True if the archive is being written with O_DIRECT.  */
+static bool direct_archive;
+
 size_t
 sys_write_archive_buffer (void)
 {
-  return rmtwrite (archive, record_start->buffer, record_size);
+  size_t status;
+
+  if (zip_active ())
+    return zip_write (record_start->buffer, record_size);
+  status = rmtwrite (archive, record_start->buffer, record_size);
+
+#ifdef O_DIRECT
+  if (status != record_size && direct_archive && errno == EINVAL)
+    {
+      /* The device wants larger or differently aligned transfers than
+	 our records.  Go on through the page cache.  */
+      int flags = fcntl (archive, F_GETFL);
+      direct_archive = false;
+      if (0 <= flags && fcntl (archive, F_SETFL, flags & ~O_DIRECT) == 0)
+	{
+	  WARN ((0, 0, _("%s: Record size unsuitable for direct I/O;"
+			 " using the page cache"),
+		 quotearg_colon (*archive_name_cursor)));
+	  status += rmtwrite (archive, record_start->buffer + status,
+			      record_size - status);
+	}
+    }
+#endif
+  return status;
+}
+
+/* Copy SIZE bytes, a multiple of the record size, from the current
+   position of FD, open on FILE_NAME, to the current position of the archive,
+   within the kernel.  This lets file systems that support it share the
+   extents of the file instead of copying them.  Return the number of
+   bytes copied, which is also a multiple of the record size: the rest
+   of a record copied only in part is left for the caller to write.  */
+off_t
+sys_copy_to_archive (int fd, char const *file_name, off_t size)
+{
+#if HAVE_COPY_FILE_RANGE
+  /* True if the system lacks copy_file_range.  */
+  static bool unsupported;
+  /* The last archive file copy_file_range failed to write to, which
+     is not tried again.  */
+  static bool failed;
+  static dev_t failed_dev;
+  static ino_t failed_ino;
+  off_t copied = 0;
+  off_t partial;
+
+  if (unsupported || _isrmt (archive) || zip_active ()
+      || !S_ISREG (archive_stat.st_mode)
+      || (failed && archive_stat.st_dev == failed_dev
+	  && archive_stat.st_ino == failed_ino))
+    return 0;
+
+  while (copied < size)
+    {
+      size_t chunk = size - copied < SSIZE_MAX ? size - copied : SSIZE_MAX;
+      ssize_t n = copy_file_range (fd, NULL, archive, NULL, chunk, 0);
+      if (n <= 0)
+	{
+	  if (n < 0)
+	    switch (errno)
+	      {
+	      case ENOSYS:
+		unsupported = true;
+		break;
+
+	      case EXDEV:
+	      case EINVAL:
+	      case EOPNOTSUPP:
+		failed = true;
+		failed_dev = archive_stat.st_dev;
+		failed_ino = archive_stat.st_ino;
+		break;
+	      }
+	  break;
+	}
+      copied += n;
+    }
+
+  partial = copied % record_size;
+  if (partial)
+    {
+      if (lseek (archive, - partial, SEEK_CUR) < 0)
+	{
+	  seek_error_details (*archive_name_cursor, - partial);
+	  fatal_exit ();
+	}
+      if (lseek (fd, - partial, SEEK_CUR) < 0)
+	{
+	  seek_error_details (file_name, - partial);
+	  fatal_exit ();
+	}
+      copied -= partial;
+    }
+  return copied;
+#else
+  return 0;
+#endif
+}
+
+/* If --direct-io was given, write the archive just opened with O_DIRECT,
+   bypassing the page cache.  This is done only for local regular files
+   and block devices.  */
+void
+sys_direct_archive (void)
+{
+#ifdef O_DIRECT
+  struct stat st;
+  int flags;
+
+  direct_archive = false;
+  if (!direct_io_option || _isrmt (archive) || zip_active ()
+      || fstat (archive, &st) != 0
+      || !(S_ISREG (st.st_mode) || S_ISBLK (st.st_mode)))
+    return;
+  flags = fcntl (archive, F_GETFL);
+  if (0 <= flags && fcntl (archive, F_SETFL, flags | O_DIRECT) == 0)
+    direct_archive = true;
+  else
+    WARN ((0, errno, _("%s: Cannot use direct I/O"),
+	   quotearg_colon (*archive_name_cursor)));
+#endif
 }
 
 #define	PREAD 0			/* read file descriptor from pipe() */
@@ -309,9 +497,11 @@ wait_for_grandchild (pid_t pid)
   exit (exit_code);
 }
 
-/* Set ARCHIVE for writing, then compressing an archive.  */
+/* Set ARCHIVE for writing, then compressing an archive.  If APPEND,
+   the compressed data is added to the end of the existing archive,
+   which must be a regular file.  */
 pid_t
-sys_child_open_for_compress (void)
+sys_child_open_for_compress (bool append)
 {
   int parent_pipe[2];
   int child_pipe[2];
@@ -319,6 +509,7 @@ sys_child_open_for_compress (void)
   pid_t child_pid;
 
   xpipe (parent_pipe);
+  enlarge_pipe (parent_pipe[PWRITE]);
   child_pid = xfork ();
 
   if (child_pid > 0)
@@ -340,19 +531,26 @@ sys_child_open_for_compress (void)
 
   /* Check if we need a grandchild tar.  This happens only if either:
      a) the file is to be accessed by rmt: compressor doesn't know how;
-     b) the file is not a plain file.  */
-
-  if (!_remdev (archive_name_array[0])
-      && is_regular_file (archive_name_array[0]))
+     b) the file is a device or the like: to force reblocking.
+     Otherwise the compressor writes the archive itself, which saves
+     copying all of it through one more process.  */
+
+  if (strcmp (archive_name_array[0], "-") == 0
+      ? !is_device (STDOUT_FILENO)
+      : (!_remdev (archive_name_array[0])
+	 && is_stream_file (archive_name_array[0])))
     {
-      if (backup_option)
+      if (backup_option && !append)
 	maybe_backup_file (archive_name_array[0], 1);
 
       /* We don't need a grandchild tar.  Open the archive and launch the
 	 compressor.  */
       if (strcmp (archive_name_array[0], "-"))
 	{
-	  archive = creat (archive_name_array[0], MODE_RW);
+	  archive = (append
+		     ? open (archive_name_array[0],
+			     O_WRONLY | O_APPEND | O_BINARY)
+		     : creat (archive_name_array[0], MODE_RW));
 	  if (archive < 0)
 	    {
 	      int saved_errno = errno;
@@ -478,9 +676,11 @@ run_decompress_program (void)
   exec_fatal (prog);
 }
 
-/* Set ARCHIVE for uncompressing, then reading an archive.  */
+/* Set ARCHIVE for uncompressing, then reading an archive.  A nonzero
+   OFFSET starts the uncompressor that far into the archive, which must
+   be a regular file.  */
 pid_t
-sys_child_open_for_uncompress (void)
+sys_child_open_for_uncompress (off_t offset)
 {
   int parent_pipe[2];
   int child_pipe[2];
@@ -488,6 +688,7 @@ sys_child_open_for_uncompress (void)
   pid_t child_pid;
 
   xpipe (parent_pipe);
+  enlarge_pipe (parent_pipe[PREAD]);
   child_pid = xfork ();
 
   if (child_pid > 0)
@@ -508,21 +709,33 @@ sys_child_open_for_uncompress (void)
   xclose (parent_pipe[PREAD]);
 
   /* Check if we need a grandchild tar.  This happens only if either:
-     a) we're reading stdin: to force unblocking;
+     a) we're reading a device on stdin: to force unblocking;
      b) the file is to be accessed by rmt: compressor doesn't know how;
-     c) the file is not a plain file.  */
-
-  if (strcmp (archive_name_array[0], "-") != 0
-      && !_remdev (archive_name_array[0])
-      && is_regular_file (archive_name_array[0]))
+     c) the file is a device or the like: to force unblocking.
+     Otherwise the uncompressor reads the archive itself, which saves
+     copying all of it through one more process.  */
+
+  if (strcmp (archive_name_array[0], "-") == 0
+      ? !is_device (STDIN_FILENO)
+      : (!_remdev (archive_name_array[0])
+	 && is_stream_file (archive_name_array[0])))
     {
       /* We don't need a grandchild tar.  Open the archive and lauch the
 	 uncompressor.  */
 
-      archive = open (archive_name_array[0], O_RDONLY | O_BINARY, MODE_RW);
-      if (archive < 0)
-	open_fatal (archive_name_array[0]);
-      xdup2 (archive, STDIN_FILENO);
+      if (strcmp (archive_name_array[0], "-") != 0)
+	{
+	  archive = open (archive_name_array[0], O_RDONLY | O_BINARY,
+			  MODE_RW);
+	  if (archive < 0)
+	    open_fatal (archive_name_array[0]);
+	  if (offset && lseek (archive, offset, SEEK_SET) != offset)
+	    {
+	      seek_error_details (archive_name_array[0], offset);
+	      fatal_exit ();
+	    }
+	  xdup2 (archive, STDIN_FILENO);
+	}
       priv_set_restore_linkdir ();
       run_decompress_program ();
     }
@@ -564,9 +777,6 @@ sys_child_open_for_uncompress (void)
 
   while (1)
     {
-      char *cursor;
-      size_t maximum;
-      size_t count;
       size_t status;
 
       clear_read_error_count ();
@@ -580,16 +790,8 @@ sys_child_open_for_uncompress (void)
 	}
       if (status == 0)
 	break;
-      cursor = record_start->buffer;
-      maximum = status;
-      while (maximum)
-	{
-	  count = maximum < BLOCKSIZE ? maximum : BLOCKSIZE;
-	  if (full_write (STDOUT_FILENO, cursor, count) != count)
-	    write_error (use_compress_program_option);
-	  cursor += count;
-	  maximum -= count;
-	}
+      if (full_write (STDOUT_FILENO, record_start->buffer, status) != status)
+	write_error (use_compress_program_option);
     }
 
   xclose (STDOUT_FILENO);
@@ -261,9 +261,14 @@ enum
   CHECK_DEVICE_OPTION,
   CHECKPOINT_OPTION,
   CHECKPOINT_ACTION_OPTION,
+  COMPRESS_BLOCK_OPTION,
+  COMPRESS_THREADS_OPTION,
+  COPY_DUPLICATES_OPTION,
+  DEDUPLICATE_OPTION,
   DELAY_DIRECTORY_RESTORE_OPTION,
   HARD_DEREFERENCE_OPTION,
   DELETE_OPTION,
+  DIRECT_IO_OPTION,
   EXCLUDE_BACKUPS_OPTION,
   EXCLUDE_CACHES_OPTION,
   EXCLUDE_CACHES_UNDER_OPTION,
@@ -275,11 +280,13 @@ enum
   EXCLUDE_VCS_OPTION,
   FORCE_LOCAL_OPTION,
   FULL_TIME_OPTION,
+  GROUP_FILE_OPTION,
   GROUP_OPTION,
   IGNORE_CASE_OPTION,
   IGNORE_COMMAND_ERROR_OPTION,
   IGNORE_FAILED_READ_OPTION,
   INDEX_FILE_OPTION,
+  IO_URING_OPTION,
   KEEP_NEWER_FILES_OPTION,
   LEVEL_OPTION,
   LZIP_OPTION,
@@ -312,11 +319,15 @@ enum
   OVERWRITE_DIR_OPTION,
   OVERWRITE_OPTION,
   OWNER_OPTION,
+  PASSWD_FILE_OPTION,
   PAX_OPTION,
   POSIX_OPTION,
+  PREFETCH_OPTION,
+  PREFETCH_SIZE_OPTION,
   PRESERVE_OPTION,
   QUOTE_CHARS_OPTION,
   QUOTING_STYLE_OPTION,
+  READ_AHEAD_OPTION,
   RECORD_SIZE_OPTION,
   RECURSION_OPTION,
   RECURSIVE_UNLINK_OPTION,
@@ -325,9 +336,11 @@ enum
   RMT_COMMAND_OPTION,
   RSH_COMMAND_OPTION,
   SAME_OWNER_OPTION,
+  SEEKABLE_COMPRESSION_OPTION,
   SHOW_DEFAULTS_OPTION,
   SHOW_OMITTED_DIRS_OPTION,
   SHOW_TRANSFORMED_NAMES_OPTION,
+  SORT_OPTION,
   SPARSE_VERSION_OPTION,
   STRIP_COMPONENTS_OPTION,
   SUFFIX_OPTION,
@@ -340,7 +353,9 @@ enum
   VOLNO_FILE_OPTION,
   WARNING_OPTION,
   WILDCARDS_MATCH_SLASH_OPTION,
-  WILDCARDS_OPTION
+  WILDCARDS_OPTION,
+  WRITE_BEHIND_OPTION,
+  ZSTD_OPTION
 };
 
 const char *argp_program_version = "tar (" PACKAGE_NAME ") " VERSION;
@@ -507,6 +522,12 @@ static struct argp_option options[] = {
    N_("extract files as yourself (default for ordinary users)"), GRID+1 },
   {"numeric-owner", NUMERIC_OWNER_OPTION, 0, 0,
    N_("always use numbers for user/group names"), GRID+1 },
+  {"passwd-file", PASSWD_FILE_OPTION, N_("FILE"), 0,
+   N_("look up user names and IDs in FILE, in /etc/passwd format,"
+      " instead of the system database"), GRID+1 },
+  {"group-file", GROUP_FILE_OPTION, N_("FILE"), 0,
+   N_("look up group names and IDs in FILE, in /etc/group format,"
+      " instead of the system database"), GRID+1 },
   {"preserve-permissions", 'p', 0, 0,
    N_("extract information about file permissions (default for superuser)"),
    GRID+1 },
@@ -576,6 +597,18 @@ static struct argp_option options[] = {
    N_("ignore zeroed blocks in archive (means EOF)"), GRID+1 },
   {"read-full-records", 'B', 0, 0,
    N_("reblock as we read (for 4.2BSD pipes)"), GRID+1 },
+  {"read-ahead", READ_AHEAD_OPTION, N_("RECORDS"), OPTION_ARG_OPTIONAL,
+   N_("when reading, let a separate process read the archive, keeping"
+      " up to RECORDS records (default 8) ahead"), GRID+1 },
+  {"write-behind", WRITE_BEHIND_OPTION, N_("RECORDS"), OPTION_ARG_OPTIONAL,
+   N_("when creating, let a separate process write the archive, keeping"
+      " up to RECORDS records (default 8) queued for it"), GRID+1 },
+  {"direct-io", DIRECT_IO_OPTION, 0, 0,
+   N_("write the archive bypassing the system's page cache (O_DIRECT)"),
+   GRID+1 },
+  {"io-uring", IO_URING_OPTION, N_("N"), OPTION_ARG_OPTIONAL,
+   N_("read and write member files and archive files through io_uring,"
+      " keeping up to N requests (default 8) in progress on each"), GRID+1 },
 #undef GRID
 
 #define GRID 80
@@ -619,6 +652,17 @@ static struct argp_option options[] = {
    GRID+1 },
   {"use-compress-program", 'I', N_("PROG"), 0,
    N_("filter through PROG (must accept -d)"), GRID+1 },
+  {"compress-threads", COMPRESS_THREADS_OPTION, N_("N"), 0,
+   N_("compress the archive in independent chunks, N at a time"
+      " (gzip, bzip2, xz and zstd)"), GRID+1 },
+  {"compress-block-size", COMPRESS_BLOCK_OPTION, N_("SIZE"), 0,
+   N_("with --compress-threads, compress chunks of SIZE bytes (1M by"
+      " default)"), GRID+1 },
+  {"seekable-compression", SEEKABLE_COMPRESSION_OPTION, N_("SIZE"),
+   OPTION_ARG_OPTIONAL,
+   N_("compress the archive in independent frames of SIZE bytes (64M by"
+      " default) and index them, so that members can be skipped without"
+      " decompressing them (gzip and zstd only)"), GRID+1 },
   /* Note: docstrings for the options below are generated by tar_help_filter */
   {"bzip2", 'j', 0, 0, NULL, GRID+1 },
   {"gzip", 'z', 0, 0, NULL, GRID+1 },
@@ -630,6 +674,7 @@ static struct argp_option options[] = {
   {"lzma", LZMA_OPTION, 0, 0, NULL, GRID+1 },
   {"lzop", LZOP_OPTION, 0, 0, NULL, GRID+1 },
   {"xz", 'J', 0, 0, NULL, GRID+1 },
+  {"zstd", ZSTD_OPTION, 0, 0, NULL, GRID+1 },
 #undef GRID
 
 #define GRID 100
@@ -677,6 +722,16 @@ static struct argp_option options[] = {
    N_("avoid descending automatically in directories"), GRID+1 },
   {"one-file-system", ONE_FILE_SYSTEM_OPTION, 0, 0,
    N_("stay in local file system when creating archive"), GRID+1 },
+  {"prefetch", PREFETCH_OPTION, N_("N"), OPTION_ARG_OPTIONAL,
+   N_("when creating, let N processes (default 4) stat and read ahead the"
+      " files of each directory before they are archived"), GRID+1 },
+  {"prefetch-size", PREFETCH_SIZE_OPTION, N_("SIZE"), 0,
+   N_("let the --prefetch processes read the contents of the files into"
+      " SIZE bytes of memory, from where they are archived (implies"
+      " --prefetch)"), GRID+1 },
+  {"sort", SORT_OPTION, N_("ORDER"), 0,
+   N_("archive the entries of each directory in ORDER: none (default),"
+      " name, inode or extent (physical position on the disk)"), GRID+1 },
   {"recursion", RECURSION_OPTION, 0, 0,
    N_("recurse into directories (default)"), GRID+1 },
   {"absolute-names", 'P', 0, 0,
@@ -685,6 +740,12 @@ static struct argp_option options[] = {
    N_("follow symlinks; archive and dump the files they point to"), GRID+1 },
   {"hard-dereference", HARD_DEREFERENCE_OPTION, 0, 0,
    N_("follow hard links; archive and dump the files they refer to"), GRID+1 },
+  {"deduplicate", DEDUPLICATE_OPTION, 0, 0,
+   N_("archive files whose contents are identical to that of a file"
+      " already archived as links to that file"), GRID+1 },
+  {"copy-duplicates", COPY_DUPLICATES_OPTION, 0, 0,
+   N_("extract the links created by --deduplicate as copies of their"
+      " targets"), GRID+1 },
   {"starting-file", 'K', N_("MEMBER-NAME"), 0,
    N_("begin at member MEMBER-NAME in the archive"), GRID+1 },
   {"newer", 'N', N_("DATE-OR-FILE"), 0,
@@ -812,6 +873,18 @@ static enum atime_preserve const atime_preserve_types[] =
    (minus 1 for NULL guard) */
 ARGMATCH_VERIFY (atime_preserve_args, atime_preserve_types);
 
+static char const *const sort_args[] =
+{
+  "none", "name", "inode", "extent", NULL
+};
+
+static enum sort_order const sort_types[] =
+{
+  no_sort, name_sort, inode_sort, extent_sort
+};
+
+ARGMATCH_VERIFY (sort_args, sort_types);
+
 /* Wildcard matching settings */
 enum wildcards
   {
@@ -838,6 +911,10 @@ struct tar_args        /* Variables used during option parsing */
   bool input_files;                /* True if some input files where given */
   int compress_autodetect;         /* True if compression autodetection should
 				      be attempted when creating archives */
+  char const *owner;               /* --owner option argument */
+  char const *group;               /* --group option argument */
+  char const *passwd_file;         /* --passwd-file option argument */
+  char const *group_file;          /* --group-file option argument */
 };
 
 
@@ -1288,6 +1365,10 @@ tar_help_filter (int key, const char *text, void *input)
       s = xasprintf (_("filter the archive through %s"), XZ_PROGRAM);
       break;
 
+    case ZSTD_OPTION:
+      s = xasprintf (_("filter the archive through %s"), ZSTD_PROGRAM);
+      break;
+
     case ARGP_KEY_HELP_EXTRA:
       {
 	const char *tstr;
@@ -1363,6 +1444,20 @@ expand_pax_option (struct tar_args *targs, const char *arg)
   return res;
 }
 
+/* Parse ARG, the number of records in a --read-ahead or --write-behind
+   ring.  */
+static size_t
+parse_ring_records (char const *arg)
+{
+  uintmax_t u;
+
+  if (! (xstrtoumax (arg, NULL, 10, &u, "") == LONGINT_OK
+	 && u == (size_t) u && 2 <= u))
+    USAGE_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
+		  _("Invalid number of records")));
+  return u;
+}
+
 
 #define TAR_SIZE_SUFFIXES "bBcGgkKMmPTtw"
 
@@ -1469,6 +1564,14 @@ parse_opt (int key, char *arg, struct argp_state *state)
       hard_dereference_option = true;
       break;
 
+    case DEDUPLICATE_OPTION:
+      deduplicate_option = true;
+      break;
+
+    case COPY_DUPLICATES_OPTION:
+      copy_duplicates_option = true;
+      break;
+
     case 'i':
       /* Ignore zero blocks (eofs).  This can't be the default,
 	 because Unix tar writes two blocks of zeros, then pads out
@@ -1542,6 +1645,10 @@ parse_opt (int key, char *arg, struct argp_state *state)
       set_use_compress_program_option (LZOP_PROGRAM);
       break;
 
+    case ZSTD_OPTION:
+      set_use_compress_program_option (ZSTD_PROGRAM);
+      break;
+
     case 'm':
       touch_option = true;
       break;
@@ -1835,18 +1942,12 @@ parse_opt (int key, char *arg, struct argp_state *state)
       old_files_option = KEEP_NEWER_FILES;
       break;
 
+    case GROUP_FILE_OPTION:
+      args->group_file = arg;
+      break;
+
     case GROUP_OPTION:
-      if (! (strlen (arg) < GNAME_FIELD_SIZE
-	     && gname_to_gid (arg, &group_option)))
-	{
-	  uintmax_t g;
-	  if (xstrtoumax (arg, 0, 10, &g, "") == LONGINT_OK
-	      && g == (gid_t) g)
-	    group_option = g;
-	  else
-	    FATAL_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
-			  _("Invalid group")));
-	}
+      args->group = arg;
       break;
 
     case MODE_OPTION:
@@ -1922,17 +2023,7 @@ parse_opt (int key, char *arg, struct argp_state *state)
       break;
 
     case OWNER_OPTION:
-      if (! (strlen (arg) < UNAME_FIELD_SIZE
-	     && uname_to_uid (arg, &owner_option)))
-	{
-	  uintmax_t u;
-	  if (xstrtoumax (arg, 0, 10, &u, "") == LONGINT_OK
-	      && u == (uid_t) u)
-	    owner_option = u;
-	  else
-	    FATAL_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
-			  _("Invalid owner")));
-	}
+      args->owner = arg;
       break;
 
     case QUOTE_CHARS_OPTION:
@@ -1944,6 +2035,28 @@ parse_opt (int key, char *arg, struct argp_state *state)
       tar_set_quoting_style (arg);
       break;
 
+    case IO_URING_OPTION:
+      if (!arg)
+	io_uring_option = DEFAULT_IO_URING;
+      else
+	{
+	  uintmax_t u;
+	  if (! (xstrtoumax (arg, NULL, 10, &u, "") == LONGINT_OK
+		 && 2 <= u && u <= 4096))
+	    USAGE_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
+			  _("Invalid number of requests")));
+	  io_uring_option = u;
+	}
+      break;
+
+    case READ_AHEAD_OPTION:
+      read_ahead_option = arg ? parse_ring_records (arg) : DEFAULT_READ_AHEAD;
+      break;
+
+    case PASSWD_FILE_OPTION:
+      args->passwd_file = arg;
+      break;
+
     case PAX_OPTION:
       {
 	char *tmp = expand_pax_option (args, arg);
@@ -2055,6 +2168,42 @@ parse_opt (int key, char *arg, struct argp_state *state)
       set_use_compress_program_option (arg);
       break;
 
+    case COMPRESS_THREADS_OPTION:
+      {
+	uintmax_t u;
+	if (! (xstrtoumax (arg, NULL, 10, &u, "") == LONGINT_OK
+	       && 0 < u && u <= INT_MAX))
+	  USAGE_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
+			_("Invalid number of threads")));
+	compress_threads_option = u;
+      }
+      break;
+
+    case COMPRESS_BLOCK_OPTION:
+      {
+	uintmax_t u;
+	if (! (xstrtoumax (arg, NULL, 10, &u, "kKmMgG") == LONGINT_OK
+	       && u % 1024 == 0 && 32 * 1024 <= u))
+	  USAGE_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
+			_("Invalid chunk size")));
+	compress_block_option = u / 1024;
+      }
+      break;
+
+    case SEEKABLE_COMPRESSION_OPTION:
+      if (!arg)
+	seekable_compression_option = DEFAULT_SEEKABLE_FRAME;
+      else
+	{
+	  uintmax_t u;
+	  if (! (xstrtoumax (arg, NULL, 10, &u, "kKmMgG") == LONGINT_OK
+		 && 0 < u && u <= SIZE_MAX))
+	    USAGE_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
+			  _("Invalid frame size")));
+	  seekable_compression_option = u;
+	}
+      break;
+
     case VOLNO_FILE_OPTION:
       volno_file_option = arg;
       break;
@@ -2067,6 +2216,46 @@ parse_opt (int key, char *arg, struct argp_state *state)
       args->matching_flags &= ~ FNM_FILE_NAME;
       break;
 
+    case DIRECT_IO_OPTION:
+      direct_io_option = true;
+      break;
+
+    case PREFETCH_OPTION:
+      if (!arg)
+	prefetch_option = DEFAULT_PREFETCH;
+      else
+	{
+	  uintmax_t u;
+	  if (! (xstrtoumax (arg, NULL, 10, &u, "") == LONGINT_OK
+		 && u <= 1024))
+	    USAGE_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
+			  _("Invalid number of processes")));
+	  prefetch_option = u;
+	}
+      break;
+
+    case SORT_OPTION:
+      sort_option = XARGMATCH ("--sort", arg, sort_args, sort_types);
+      break;
+
+    case PREFETCH_SIZE_OPTION:
+      {
+	uintmax_t u;
+	if (! (xstrtoumax (arg, NULL, 10, &u, "kKmMgG") == LONGINT_OK
+	       && u <= SIZE_MAX))
+	  USAGE_ERROR ((0, 0, "%s: %s", quotearg_colon (arg),
+			_("Invalid prefetch size")));
+	prefetch_size_option = u;
+	if (!prefetch_option)
+	  prefetch_option = DEFAULT_PREFETCH;
+      }
+      break;
+
+    case WRITE_BEHIND_OPTION:
+      write_behind_option = arg ? parse_ring_records (arg)
+	                        : DEFAULT_WRITE_BEHIND;
+      break;
+
     case NO_RECURSION_OPTION:
       recursion_option = 0;
       break;
@@ -2228,6 +2417,10 @@ decode_options (int argc, char **argv)
   args.version_control_string = 0;
   args.input_files = false;
   args.compress_autodetect = false;
+  args.owner = NULL;
+  args.group = NULL;
+  args.passwd_file = NULL;
+  args.group_file = NULL;
 
   subcommand_option = UNKNOWN_SUBCOMMAND;
   archive_format = DEFAULT_FORMAT;
@@ -2338,6 +2531,39 @@ decode_options (int argc, char **argv)
 	}
     }
 
+  /* Read the user and group files before resolving the names given to
+     --owner and --group in them, whatever the order of the options.  */
+  if (args.passwd_file)
+    read_id_file (args.passwd_file, false);
+  if (args.group_file)
+    read_id_file (args.group_file, true);
+
+  if (args.owner
+      && ! (strlen (args.owner) < UNAME_FIELD_SIZE
+	    && uname_to_uid (args.owner, &owner_option)))
+    {
+      uintmax_t u;
+      if (xstrtoumax (args.owner, 0, 10, &u, "") == LONGINT_OK
+	  && u == (uid_t) u)
+	owner_option = u;
+      else
+	FATAL_ERROR ((0, 0, "%s: %s", quotearg_colon (args.owner),
+		      _("Invalid owner")));
+    }
+
+  if (args.group
+      && ! (strlen (args.group) < GNAME_FIELD_SIZE
+	    && gname_to_gid (args.group, &group_option)))
+    {
+      uintmax_t g;
+      if (xstrtoumax (args.group, 0, 10, &g, "") == LONGINT_OK
+	  && g == (gid_t) g)
+	group_option = g;
+      else
+	FATAL_ERROR ((0, 0, "%s: %s", quotearg_colon (args.group),
+		      _("Invalid group")));
+    }
+
   /* Handle operands after any "--" argument.  */
   for (; idx < argc; idx++)
     {
@@ -318,6 +318,10 @@ struct tar_stat_info
 			       (for GNUTYPE_DUMPDIR) */
   char *dumpdir;            /* Contents of the dump directory */
 
+  /* For links created by --deduplicate */
+  bool is_duplicate;        /* The member is a copy of its link target,
+			       not a hard link to it */
+
   /* Parent directory, if creating an archive.  This is null if the
      file is at the top level.  */
   struct tar_stat_info *parent;
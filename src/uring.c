@@ -0,0 +1,550 @@
+/* Queued file input and output through io_uring, for tar.
+
+   Copyright (C) 2011 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; either version 3, or (at your option) any later
+   version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+   Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* With --io-uring, tar reads and writes the data of member files, and
+   archives that are regular files, through a Linux io_uring, so that
+   several requests are in progress on the device at once instead of
+   one.  A stream reads a file sequentially ahead of what tar consumes,
+   or queues what tar writes to it, in buffers of its own: tar still
+   sees plain sequential reads and writes.  The ring is driven through
+   its system calls directly.
+
+   When the system does not support io_uring, tar warns once and goes
+   on with ordinary reads and writes.  */
+
+#include <system.h>
+
+#if HAVE_LINUX_IO_URING_H && HAVE_DECL___NR_IO_URING_SETUP \
+    && HAVE_DECL___NR_IO_URING_ENTER && HAVE_SYS_MMAN_H
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# define HAVE_URING 1
+#else
+# define HAVE_URING 0
+#endif
+
+#include "common.h"
+
+/* A read or write request, with its own buffer.  */
+struct uring_request
+{
+  struct iovec iov;             /* Buffer and size of the request */
+  off_t offset;                 /* Offset in the file */
+  ssize_t result;               /* Outcome: size transferred, or minus
+				   the error number */
+  bool busy;                    /* Submitted and not completed yet */
+};
+
+/* A file read or written sequentially.  Its requests form a ring, of
+   which COUNT, starting at HEAD, are in use: submitted, or completed
+   and not consumed yet.  */
+struct uring_stream
+{
+  int fd;                       /* File descriptor */
+  bool write;                   /* Is the file written? */
+  off_t offset;                 /* Offset of the next request */
+  off_t end;                    /* When reading, offset not to read past,
+				   or -1 */
+  off_t pos;                    /* When reading, offset of the next byte
+				   to return to tar */
+  size_t chunk;                 /* Size of the buffers */
+  size_t slots;                 /* Number of requests */
+  char *buffer;                 /* Buffers of all requests */
+  struct uring_request *req;    /* Requests */
+  size_t head;                  /* Oldest request in use */
+  size_t count;                 /* Number of requests in use */
+  size_t fill;                  /* When reading, bytes of the head request
+				   already returned; when writing, bytes
+				   in the request being filled */
+  bool eof;                     /* When reading, no more requests are to
+				   be submitted */
+  int error;                    /* First error number, or 0 */
+  struct uring_stream *next;    /* Next spare stream */
+};
+
+/* Streams closed, kept with their buffers for reuse.  */
+static struct uring_stream *uring_spare;
+
+/* Warn that io_uring cannot be used, with error number ERRNUM, unless
+   this was already done.  */
+static void
+uring_unavailable (int errnum)
+{
+  static bool warned;
+
+  if (!warned)
+    {
+      WARN ((0, errnum, _("--io-uring ignored: io_uring is not available")));
+      warned = true;
+    }
+}
+
+#if HAVE_URING
+
+/* The ring: its descriptor, the number of entries in its submission
+   queue and the number of requests they are taken up by, and how many
+   of them are queued but not submitted yet.  */
+static int uring_fd = -1;
+static unsigned uring_entries;
+static unsigned uring_used;
+static unsigned uring_unsubmitted;
+static bool uring_failed;
+
+/* Shared queue indices and arrays.  */
+static unsigned *sq_tail;
+static unsigned *sq_mask;
+static unsigned *sq_array;
+static struct io_uring_sqe *sqes;
+static unsigned *cq_head;
+static unsigned *cq_tail;
+static unsigned *cq_mask;
+static struct io_uring_cqe *cqes;
+
+/* Set up the ring, large enough for two streams of io_uring_option
+   requests each: a member file and the archive.  Return false if the
+   system does not allow it.  */
+static bool
+uring_setup (void)
+{
+  struct io_uring_params p;
+  size_t sq_size, cq_size, sqe_size;
+  char *sq, *cq;
+  void *ptr;
+  int fd;
+
+  if (uring_failed)
+    return false;
+
+  memset (&p, 0, sizeof p);
+  fd = syscall (__NR_io_uring_setup, 2 * io_uring_option, &p);
+  if (fd < 0)
+    {
+      uring_failed = true;
+      uring_unavailable (errno);
+      return false;
+    }
+
+  sq_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  sqe_size = p.sq_entries * sizeof (struct io_uring_sqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    sq_size = cq_size = sq_size < cq_size ? cq_size : sq_size;
+
+  sq = mmap (NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+	     IORING_OFF_SQ_RING);
+  cq = (sq == MAP_FAILED || (p.features & IORING_FEAT_SINGLE_MMAP)
+	? sq
+	: mmap (NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		IORING_OFF_CQ_RING));
+  ptr = (cq == MAP_FAILED
+	 ? MAP_FAILED
+	 : mmap (NULL, sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		 IORING_OFF_SQES));
+  if (ptr == MAP_FAILED)
+    {
+      int e = errno;
+      close (fd);
+      uring_failed = true;
+      uring_unavailable (e);
+      return false;
+    }
+
+  sq_tail = (unsigned *) (sq + p.sq_off.tail);
+  sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+  sq_array = (unsigned *) (sq + p.sq_off.array);
+  sqes = ptr;
+  cq_head = (unsigned *) (cq + p.cq_off.head);
+  cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+  uring_fd = fd;
+  uring_entries = p.sq_entries;
+  return true;
+}
+
+/* Queue request R of stream S.  */
+static void
+uring_queue (struct uring_stream *s, struct uring_request *r)
+{
+  unsigned tail = *sq_tail;
+  unsigned index = tail & *sq_mask;
+  struct io_uring_sqe *sqe = &sqes[index];
+
+  memset (sqe, 0, sizeof *sqe);
+  sqe->opcode = s->write ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd = s->fd;
+  sqe->off = r->offset;
+  sqe->addr = (uintptr_t) &r->iov;
+  sqe->len = 1;
+  sqe->user_data = (uintptr_t) r;
+  sq_array[index] = index;
+  __atomic_store_n (sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->busy = true;
+  uring_unsubmitted++;
+}
+
+/* Submit the queued requests and, if WAIT, wait for at least one
+   request to complete.  */
+static void
+uring_enter (bool wait)
+{
+  do
+    {
+      int n = syscall (__NR_io_uring_enter, uring_fd, uring_unsubmitted,
+		       wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0,
+		       NULL, 0);
+      if (n < 0)
+	{
+	  if (errno != EINTR)
+	    FATAL_ERROR ((0, errno, _("Cannot submit I/O requests")));
+	}
+      else
+	{
+	  uring_unsubmitted -= n;
+	  wait = false;
+	}
+    }
+  while (uring_unsubmitted || wait);
+}
+
+/* Record the outcome of the requests that have completed.  */
+static void
+uring_reap (void)
+{
+  unsigned head = *cq_head;
+
+  while (head != __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE))
+    {
+      struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+      struct uring_request *r = (struct uring_request *) (uintptr_t)
+	                        cqe->user_data;
+      r->result = cqe->res;
+      r->busy = false;
+      head++;
+    }
+  __atomic_store_n (cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Wait until request R has completed.  */
+static void
+uring_wait (struct uring_request *r)
+{
+  if (uring_unsubmitted)
+    uring_enter (false);
+  for (uring_reap (); r->busy; uring_reap ())
+    uring_enter (true);
+}
+
+#endif /* HAVE_URING */
+
+/* Return a stream for FD, whose requests are of CHUNK bytes, or NULL
+   if --io-uring is not in effect or cannot be honored.  */
+static struct uring_stream *
+uring_open (int fd, size_t chunk, bool write)
+{
+#if HAVE_URING
+  struct uring_stream *s;
+  struct uring_stream **p;
+  size_t i;
+
+  if (!io_uring_option || (uring_fd < 0 && !uring_setup ())
+      || uring_entries - uring_used < io_uring_option)
+    return NULL;
+
+  for (p = &uring_spare; (s = *p); p = &s->next)
+    if (s->chunk == chunk)
+      {
+	*p = s->next;
+	break;
+      }
+  if (!s)
+    {
+      s = xmalloc (sizeof *s);
+      s->chunk = chunk;
+      s->slots = io_uring_option;
+      s->buffer = xnmalloc (s->slots, chunk);
+      s->req = xcalloc (s->slots, sizeof *s->req);
+      for (i = 0; i < s->slots; i++)
+	s->req[i].iov.iov_base = s->buffer + i * chunk;
+    }
+
+  uring_used += s->slots;
+  s->fd = fd;
+  s->write = write;
+  s->head = s->count = s->fill = 0;
+  s->eof = false;
+  s->error = 0;
+  return s;
+#else
+  if (io_uring_option)
+    uring_unavailable (ENOSYS);
+  return NULL;
+#endif
+}
+
+/* Start reading the SIZE bytes of FD at OFFSET, or up to its end if
+   SIZE is negative, in requests of CHUNK bytes.  Return NULL if the
+   file is to be read as usual.  */
+struct uring_stream *
+uring_open_read (int fd, off_t offset, off_t size, size_t chunk)
+{
+  struct uring_stream *s = uring_open (fd, chunk, false);
+
+  if (s)
+    {
+      s->offset = s->pos = offset;
+      s->end = size < 0 ? -1 : offset + size;
+    }
+  return s;
+}
+
+/* Start writing FD at OFFSET, in requests of CHUNK bytes.  Return NULL
+   if the file is to be written as usual.  */
+struct uring_stream *
+uring_open_write (int fd, off_t offset, size_t chunk)
+{
+  struct uring_stream *s = uring_open (fd, chunk, true);
+
+  if (s)
+    {
+      s->offset = offset;
+      s->end = -1;
+    }
+  return s;
+}
+
+#if HAVE_URING
+
+/* Wait for the requests of S in progress, and drop them.  */
+static void
+uring_drain (struct uring_stream *s)
+{
+  for (; s->count; s->count--)
+    {
+      uring_wait (&s->req[s->head]);
+      s->head = (s->head + 1) % s->slots;
+    }
+  s->head = s->fill = 0;
+}
+
+/* Keep the free requests of the stream S being read submitted.  */
+static void
+uring_read_ahead (struct uring_stream *s)
+{
+  while (!s->eof && s->count < s->slots)
+    {
+      struct uring_request *r = &s->req[(s->head + s->count) % s->slots];
+      size_t size = s->chunk;
+
+      if (0 <= s->end)
+	{
+	  if (s->end <= s->offset)
+	    {
+	      s->eof = true;
+	      break;
+	    }
+	  if (s->end - s->offset < size)
+	    size = s->end - s->offset;
+	}
+      r->iov.iov_len = size;
+      r->offset = s->offset;
+      uring_queue (s, r);
+      s->offset += size;
+      s->count++;
+    }
+  if (uring_unsubmitted)
+    uring_enter (false);
+}
+
+/* Wait for the oldest request of the stream S being written, and
+   retire it.  Finish a short write with ordinary calls, which tell why
+   it is short.  */
+static void
+uring_write_retire (struct uring_stream *s)
+{
+  struct uring_request *r = &s->req[s->head];
+  size_t done;
+
+  uring_wait (r);
+  if (r->result < 0)
+    {
+      if (!s->error)
+	s->error = -r->result;
+    }
+  else
+    for (done = r->result; done < r->iov.iov_len && !s->error; )
+      {
+	ssize_t n = pwrite (s->fd, (char *) r->iov.iov_base + done,
+			    r->iov.iov_len - done, r->offset + done);
+	if (n <= 0)
+	  s->error = n < 0 ? errno : ENOSPC;
+	else
+	  done += n;
+      }
+  s->head = (s->head + 1) % s->slots;
+  s->count--;
+}
+
+/* Submit the request of the stream S being written that is being
+   filled, and make sure the next one is free.  */
+static void
+uring_write_submit (struct uring_stream *s)
+{
+  struct uring_request *r = &s->req[(s->head + s->count) % s->slots];
+
+  r->iov.iov_len = s->fill;
+  r->offset = s->offset;
+  uring_queue (s, r);
+  uring_enter (false);
+  s->offset += s->fill;
+  s->fill = 0;
+  if (++s->count == s->slots)
+    uring_write_retire (s);
+}
+
+#endif /* HAVE_URING */
+
+/* Read up to SIZE bytes of the stream S into BUF.  Return the number of
+   bytes read, which is less than SIZE only at the end of the data, or
+   SAFE_READ_ERROR on error.  In the latter case, uring_tell gives the
+   offset the failing read started at, from which the data can be read
+   again with ordinary calls.  */
+size_t
+uring_read (struct uring_stream *s, char *buf, size_t size)
+{
+#if HAVE_URING
+  size_t done = 0;
+  off_t start = s->pos;
+
+  while (done < size)
+    {
+      struct uring_request *r;
+      size_t n;
+
+      uring_read_ahead (s);
+      if (!s->count)
+	break;
+      r = &s->req[s->head];
+      uring_wait (r);
+      if (r->result < 0)
+	{
+	  uring_drain (s);
+	  s->eof = true;
+	  s->pos = start;
+	  errno = -r->result;
+	  return SAFE_READ_ERROR;
+	}
+
+      n = r->result - s->fill;
+      if (size - done < n)
+	n = size - done;
+      memcpy (buf + done, (char *) r->iov.iov_base + s->fill, n);
+      done += n;
+      s->pos += n;
+      s->fill += n;
+      if (s->fill == r->result)
+	{
+	  bool partial = r->result < r->iov.iov_len;
+
+	  s->head = (s->head + 1) % s->slots;
+	  s->count--;
+	  s->fill = 0;
+	  if (partial)
+	    {
+	      /* The file ends here, unless the read was cut short for
+		 another reason.  Either way, go on from this point.  */
+	      uring_drain (s);
+	      s->offset = s->pos;
+	      if (r->result == 0)
+		{
+		  s->eof = true;
+		  break;
+		}
+	    }
+	}
+    }
+  return done;
+#else
+  abort ();
+#endif
+}
+
+/* Return the offset of the next byte uring_read will return from S, or
+   that uring_write will write to S.  */
+off_t
+uring_tell (struct uring_stream *s)
+{
+  return s->write ? s->offset + s->fill : s->pos;
+}
+
+/* Write the SIZE bytes of BUF to the stream S.  Return false if an
+   error has occurred, possibly on previous data, with errno set.  */
+bool
+uring_write (struct uring_stream *s, char const *buf, size_t size)
+{
+#if HAVE_URING
+  while (size && !s->error)
+    {
+      struct uring_request *r = &s->req[(s->head + s->count) % s->slots];
+      size_t n = s->chunk - s->fill;
+
+      if (size < n)
+	n = size;
+      memcpy ((char *) r->iov.iov_base + s->fill, buf, n);
+      s->fill += n;
+      buf += n;
+      size -= n;
+      if (s->fill == s->chunk)
+	uring_write_submit (s);
+    }
+  errno = s->error;
+  return !s->error;
+#else
+  abort ();
+#endif
+}
+
+/* Stop using the stream S: wait for its requests to complete, writing
+   out its last data if it is written.  Return false if an error has
+   occurred, with errno set.  S may be NULL.  */
+bool
+uring_close (struct uring_stream *s)
+{
+  int error;
+
+  if (!s)
+    return true;
+#if HAVE_URING
+  if (s->write)
+    {
+      if (s->fill && !s->error)
+	uring_write_submit (s);
+      while (s->count)
+	uring_write_retire (s);
+    }
+  else
+    uring_drain (s);
+  uring_used -= s->slots;
+#endif
+  error = s->error;
+  s->next = uring_spare;
+  uring_spare = s;
+  errno = error;
+  return !error;
+}
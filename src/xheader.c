@@ -1407,6 +1407,24 @@ dumpdir_decoder (struct tar_stat_info *st,
   memcpy (st->dumpdir, arg, size);
 }
 
+static void
+duplicate_coder (struct tar_stat_info const *st, char const *keyword,
+		 struct xheader *xhdr, void const *data)
+{
+  code_num (1, keyword, xhdr);
+}
+
+static void
+duplicate_decoder (struct tar_stat_info *st,
+		   char const *keyword,
+		   char const *arg,
+		   size_t size __attribute__((unused)))
+{
+  uintmax_t u;
+  if (decode_num (&u, arg, 1, keyword))
+    st->is_duplicate = u != 0;
+}
+
 static void
 volume_label_coder (struct tar_stat_info const *st, char const *keyword,
 		    struct xheader *xhdr, void const *data)
@@ -1549,6 +1567,11 @@ struct xhdr_tab const xhdr_tab[] = {
   { "GNU.dumpdir",           dumpdir_coder, dumpdir_decoder,
     XHDR_PROTECTED },
 
+  /* Marks a link member whose target has the same contents, but is not
+     the same file (see --deduplicate).  */
+  { "GNU.duplicate",         duplicate_coder, duplicate_decoder,
+    XHDR_PROTECTED },
+
   /* Keeps the tape/volume label. May be present only in the global headers.
      Equivalent to GNUTYPE_VOLHDR.  */
   { "GNU.volume.label", volume_label_coder, volume_label_decoder,